@@ -0,0 +1,426 @@
+﻿#include <Net.h>
+
+#include <bit>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+
+// Нагрузочный бот: держит много одновременных сессий с сервером, сам
+// играет партии до победы и сразу начинает новую. Все сессии обслуживает
+// небольшой пул потоков ASIO, сообщения разбираются прямо в нём
+
+// Должны совпадать с сервером
+enum class MessageTypes : uint32_t {
+  ServerAccept,
+  Attack,
+  Win,
+  Spectate,
+  StopSpectate,
+  SpectatorUpdate,
+  Reclaim,
+};
+
+const int BOARD_SIZE = 10;
+
+// Должны совпадать с сервером
+enum class Shot : uint8_t { repeat, miss, hit, sunk };
+
+struct ShotResult {
+  uint8_t x = 0;
+  uint8_t y = 0;
+  Shot shot = Shot::repeat;
+};
+
+struct RevealedCells {
+  uint64_t low = 0;
+  uint64_t high = 0;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// Гистограмма задержек в наносекундах: на каждую степень двойки по
+// SUB_BUCKETS корзин, так что погрешность перцентиля не больше 1/32.
+// Запись - один atomic инкремент, её можно вести из всех потоков сразу
+class LatencyHistogram {
+ public:
+  static constexpr int SUB_BITS = 5;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr int BUCKETS = 64 * SUB_BUCKETS;
+
+ public:
+  void Record(uint64_t value) {
+    buckets_[IndexOf(value)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t Count() const {
+    uint64_t count = 0;
+    for (auto& bucket : buckets_) {
+      count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  // Нижняя граница корзины, в которую попал перцентиль percent
+  uint64_t Percentile(double percent) const {
+    uint64_t count = Count();
+    if (count == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(percent / 100.0 * (count - 1));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen > rank) return ValueOf(i);
+    }
+    return ValueOf(BUCKETS - 1);
+  }
+
+ private:
+  static int IndexOf(uint64_t value) {
+    if (value < SUB_BUCKETS) return static_cast<int>(value);
+    int msb = std::bit_width(value) - 1;
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS +
+           static_cast<int>((value >> shift) - SUB_BUCKETS);
+  }
+
+  static uint64_t ValueOf(int index) {
+    if (index < SUB_BUCKETS) return index;
+    int group = index / SUB_BUCKETS;
+    uint64_t sub = index % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (group - 1);
+  }
+
+  std::atomic<uint64_t> buckets_[BUCKETS] = {};
+};
+
+struct Options {
+  std::string host = "127.0.0.1";
+  uint16_t port = 60000;
+  size_t connections = 1000;
+  // Пауза бота перед каждым ходом
+  std::chrono::milliseconds think{0};
+  std::chrono::seconds duration{30};
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+struct Stats {
+  // Сессия считается установленной, когда пришёл ServerAccept
+  std::atomic<uint64_t> sessions = 0;
+  std::atomic<uint64_t> moves = 0;
+  std::atomic<uint64_t> games = 0;
+  // Соединение оборвалось посреди партии
+  std::atomic<uint64_t> drops = 0;
+  LatencyHistogram move_latency;
+};
+
+class Bot {
+ public:
+  using Connection = net::Connection<MessageTypes>;
+
+ public:
+  Bot(asio::io_context& context,
+      const asio::ip::tcp::resolver::results_type& endpoints,
+      const Options& options, Stats& stats, std::atomic<bool>& running,
+      uint64_t seed)
+      : context_(context),
+        endpoints_(endpoints),
+        options_(options),
+        stats_(stats),
+        running_(running),
+        timer_(context),
+        random_(seed) {
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+      order_[i] = static_cast<uint8_t>(i);
+    }
+  }
+  Bot(const Bot&) = delete;
+
+  void Start() {
+    asio::post(context_, [this]() { StartSession(); });
+  }
+
+ private:
+  // Выполняет ASIO context
+  void StartSession() {
+    game_over_ = false;
+    for (auto& cell : cells_) cell = Cell::unknown;
+    std::shuffle(std::begin(order_), std::end(order_), random_);
+    next_order_ = 0;
+    targets_.clear();
+
+    connection_ = std::make_shared<Connection>(
+        Connection::owner::client, context_, asio::ip::tcp::socket(context_),
+        unused_queue_);
+    connection_->SetMessageHandler(
+        [this](net::OwnedMessage<MessageTypes>& message) {
+          OnMessage(message);
+        });
+    connection_->ConnectToServer(endpoints_);
+  }
+
+  // Выполняет ASIO context, в strand текущего соединения
+  void OnMessage(net::OwnedMessage<MessageTypes>& incoming) {
+    if (incoming.disconnected) {
+      if (!running_) return;
+      if (game_over_) {
+        StartSession();
+        return;
+      }
+      // Сервер недоступен или оборвал партию: пробуем снова чуть позже
+      stats_.drops.fetch_add(1, std::memory_order_relaxed);
+      timer_.expires_after(std::chrono::milliseconds(100));
+      timer_.async_wait([this](std::error_code ec) {
+        if (!ec && running_) StartSession();
+      });
+      return;
+    }
+
+    auto& message = incoming.message;
+    switch (message.header.id) {
+      case MessageTypes::ServerAccept: {
+        stats_.sessions.fetch_add(1, std::memory_order_relaxed);
+        NextMove();
+      } break;
+
+      case MessageTypes::Attack: {
+        RecordMove();
+        ApplyShot(message);
+        NextMove();
+      } break;
+
+      case MessageTypes::Win: {
+        RecordMove();
+        stats_.games.fetch_add(1, std::memory_order_relaxed);
+        game_over_ = true;
+        connection_->Disconnect();
+      } break;
+
+      // Бот не следит за чужими партиями и не возвращает свои
+      default:
+        break;
+    }
+  }
+
+  void RecordMove() {
+    auto latency = Clock::now() - sent_at_;
+    stats_.moves.fetch_add(1, std::memory_order_relaxed);
+    stats_.move_latency.Record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency)
+            .count());
+  }
+
+  void ApplyShot(const net::Message<MessageTypes>& message) {
+    net::MessageReader reader(message);
+    ShotResult result;
+    if (!reader.Read(result)) return;
+    if (result.x >= BOARD_SIZE || result.y >= BOARD_SIZE) return;
+
+    int index = result.x * BOARD_SIZE + result.y;
+    if (result.shot == Shot::miss) {
+      cells_[index] = Cell::miss;
+    } else if (result.shot == Shot::hit) {
+      cells_[index] = Cell::hit;
+      // Добиваем раненый корабль: пробуем соседние клетки
+      if (result.x > 0) targets_.push_back(index - BOARD_SIZE);
+      if (result.x + 1 < BOARD_SIZE) targets_.push_back(index + BOARD_SIZE);
+      if (result.y > 0) targets_.push_back(index - 1);
+      if (result.y + 1 < BOARD_SIZE) targets_.push_back(index + 1);
+    } else if (result.shot == Shot::sunk) {
+      cells_[index] = Cell::hit;
+      RevealedCells revealed;
+      reader.Read(revealed);
+      for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+        bool is_set = i < 64 ? (revealed.low >> i) & 1
+                             : (revealed.high >> (i - 64)) & 1;
+        if (is_set) cells_[i] = Cell::miss;
+      }
+      targets_.clear();
+    }
+  }
+
+  int ChooseCell() {
+    while (!targets_.empty()) {
+      int index = targets_.back();
+      targets_.pop_back();
+      if (cells_[index] == Cell::unknown) return index;
+    }
+    while (next_order_ < BOARD_SIZE * BOARD_SIZE) {
+      int index = order_[next_order_++];
+      if (cells_[index] == Cell::unknown) return index;
+    }
+    return -1;
+  }
+
+  void NextMove() {
+    int index = ChooseCell();
+    if (index < 0) return;
+    // Клетка занята сразу, чтобы не выбрать её повторно
+    cells_[index] = Cell::pending;
+
+    char attack_pos[3] = {static_cast<char>('a' + index % BOARD_SIZE),
+                          static_cast<char>('0' + index / BOARD_SIZE), 0};
+    net::Message<MessageTypes> message;
+    message.header.id = MessageTypes::Attack;
+    net::MessageWriter(message).Write(attack_pos);
+    auto shared = net::MakeSharedMessage(std::move(message));
+
+    if (options_.think.count() == 0) {
+      SendMove(connection_, std::move(shared));
+      return;
+    }
+    timer_.expires_after(options_.think);
+    timer_.async_wait([this, connection = connection_,
+                       shared = std::move(shared)](std::error_code ec) {
+      if (!ec) SendMove(connection, shared);
+    });
+  }
+
+  void SendMove(const std::shared_ptr<Connection>& connection,
+                net::SharedMessage<MessageTypes> message) {
+    sent_at_ = Clock::now();
+    connection->Send(std::move(message));
+  }
+
+  enum class Cell : uint8_t { unknown, pending, miss, hit };
+
+  asio::io_context& context_;
+  const asio::ip::tcp::resolver::results_type& endpoints_;
+  const Options& options_;
+  Stats& stats_;
+  std::atomic<bool>& running_;
+
+  std::shared_ptr<Connection> connection_;
+  // Сообщения приходят в OnMessage, очередь соединению нужна только формально
+  net::IncomingQueue<net::OwnedMessage<MessageTypes>> unused_queue_;
+  asio::steady_timer timer_;
+  Clock::time_point sent_at_;
+  bool game_over_ = false;
+
+  std::mt19937_64 random_;
+  Cell cells_[BOARD_SIZE * BOARD_SIZE] = {};
+  // Случайный порядок обстрела клеток на эту партию
+  uint8_t order_[BOARD_SIZE * BOARD_SIZE];
+  int next_order_ = 0;
+  std::vector<int> targets_;
+};
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value =
+        equals == std::string::npos ? "" : arg.substr(equals + 1);
+    try {
+      if (key == "--host") {
+        options.host = value;
+      } else if (key == "--port") {
+        options.port = static_cast<uint16_t>(std::stoul(value));
+      } else if (key == "--connections") {
+        options.connections = std::stoul(value);
+      } else if (key == "--think-ms") {
+        options.think = std::chrono::milliseconds(std::stoul(value));
+      } else if (key == "--duration") {
+        options.duration = std::chrono::seconds(std::stoul(value));
+      } else if (key == "--threads") {
+        options.threads = std::max<size_t>(1, std::stoul(value));
+      } else {
+        return false;
+      }
+    } catch (std::exception&) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static double Micros(uint64_t nanos) { return nanos / 1000.0; }
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    std::cout << "Usage: Bot [--host=127.0.0.1] [--port=60000] "
+                 "[--connections=1000] [--think-ms=0] [--duration=30] "
+                 "[--threads=N]\n";
+    return 1;
+  }
+
+  // Context объявлен раньше ботов: соединения ботов должны быть
+  // уничтожены раньше него
+  asio::io_context context(static_cast<int>(options.threads));
+  asio::ip::tcp::resolver::results_type endpoints;
+  try {
+    asio::ip::tcp::resolver resolver(context);
+    endpoints =
+        resolver.resolve(options.host, std::to_string(options.port));
+  } catch (std::exception& e) {
+    std::cerr << "[Bot] Resolve failed: " << e.what() << "\n";
+    return 1;
+  }
+
+  Stats stats;
+  std::atomic<bool> running = true;
+  std::vector<std::unique_ptr<Bot>> bots;
+  std::random_device seed;
+  for (size_t i = 0; i < options.connections; ++i) {
+    bots.push_back(std::make_unique<Bot>(context, endpoints, options, stats,
+                                         running, seed()));
+    bots.back()->Start();
+  }
+
+  auto guard = asio::make_work_guard(context);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.threads; ++i) {
+    threads.emplace_back([&context]() { context.run(); });
+  }
+
+  std::cout << "[Bot] " << options.connections << " sessions to "
+            << options.host << ":" << options.port << ", "
+            << options.threads << " threads, think "
+            << options.think.count() << " ms\n";
+
+  auto start = Clock::now();
+  uint64_t last_sessions = 0;
+  uint64_t last_moves = 0;
+  uint64_t last_games = 0;
+  for (int second = 1; Clock::now() - start < options.duration; ++second) {
+    std::this_thread::sleep_until(start + std::chrono::seconds(second));
+    uint64_t sessions = stats.sessions.load(std::memory_order_relaxed);
+    uint64_t moves = stats.moves.load(std::memory_order_relaxed);
+    uint64_t games = stats.games.load(std::memory_order_relaxed);
+    std::printf("[Bot] %3ds connects/s %7llu moves/s %8llu games/s %6llu "
+                "drops %llu\n",
+                second, (unsigned long long)(sessions - last_sessions),
+                (unsigned long long)(moves - last_moves),
+                (unsigned long long)(games - last_games),
+                (unsigned long long)stats.drops.load());
+    last_sessions = sessions;
+    last_moves = moves;
+    last_games = games;
+  }
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  // Недоигранные партии просто бросаем: соединения закроются вместе с
+  // context
+  running = false;
+  guard.reset();
+  context.stop();
+  for (auto& thread : threads) thread.join();
+
+  auto& latency = stats.move_latency;
+  std::printf(
+      "[Bot] total: %.1f s, connects %llu (%.0f/s), moves %llu (%.0f/s), "
+      "games %llu (%.1f/s), drops %llu\n",
+      elapsed, (unsigned long long)stats.sessions.load(),
+      stats.sessions / elapsed, (unsigned long long)stats.moves.load(),
+      stats.moves / elapsed, (unsigned long long)stats.games.load(),
+      stats.games / elapsed, (unsigned long long)stats.drops.load());
+  std::printf("[Bot] move rtt: p50 %.1f us, p99 %.1f us, p999 %.1f us\n",
+              Micros(latency.Percentile(50)), Micros(latency.Percentile(99)),
+              Micros(latency.Percentile(99.9)));
+
+  bots.clear();
+  return 0;
+}
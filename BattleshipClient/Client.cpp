@@ -1,15 +1,105 @@
-﻿#include <net.h>
+﻿#include <Net.h>
 
+#include <cstdlib>
 #include <iostream>
 
 enum class MessageTypes : uint32_t {
   ServerAccept,
   Attack,
   Win,
+  Spectate,
+  StopSpectate,
+  SpectatorUpdate,
+  Reclaim,
+};
+
+const int BOARD_SIZE = 10;
+
+// Должны совпадать с сервером
+enum class Shot : uint8_t { repeat, miss, hit, sunk };
+
+struct ShotResult {
+  uint8_t x = 0;
+  uint8_t y = 0;
+  Shot shot = Shot::repeat;
+};
+
+// Клетки поля битами, клетка (x, y) имеет номер x * BOARD_SIZE + y
+struct RevealedCells {
+  uint64_t low = 0;
+  uint64_t high = 0;
 };
 
 class BattleshipClient : public net::IClient<MessageTypes> {
  public:
+  BattleshipClient() {
+    for (auto& row : board_) {
+      for (auto& mark : row) mark = ' ';
+    }
+  }
+
+  // Применяет к локальной доске результат выстрела от сервера
+  void ApplyShot(net::Message<MessageTypes>& message) {
+    net::MessageReader reader(message);
+    ShotResult result;
+    if (!reader.Read(result) || result.shot == Shot::repeat) return;
+    if (result.x >= BOARD_SIZE || result.y >= BOARD_SIZE) return;
+
+    board_[result.x][result.y] = result.shot == Shot::miss ? '@' : 'X';
+    if (result.shot == Shot::sunk) {
+      RevealedCells revealed;
+      reader.Read(revealed);
+      for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+        bool is_set = i < 64 ? (revealed.low >> i) & 1
+                             : (revealed.high >> (i - 64)) & 1;
+        if (is_set) board_[i / BOARD_SIZE][i % BOARD_SIZE] = '@';
+      }
+    }
+  }
+
+  // Просит вернуть партию, начатую до перезапуска сервера
+  void Reclaim(uint32_t game_id, uint64_t token) {
+    net::Message<MessageTypes> message;
+    message.header.id = MessageTypes::Reclaim;
+    net::MessageWriter(message).Write(game_id).Write(token);
+    Send(message);
+  }
+
+  // Открытые клетки возвращённой партии. false, если сервер отказал
+  bool ApplyReclaim(net::Message<MessageTypes>& message) {
+    net::MessageReader reader(message);
+    uint32_t game_id = 0;
+    RevealedCells hits;
+    RevealedCells misses;
+    if (!reader.Read(game_id) || game_id == 0 || !reader.Read(hits) ||
+        !reader.Read(misses)) {
+      return false;
+    }
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+      auto is_set = [i](const RevealedCells& cells) {
+        return i < 64 ? (cells.low >> i) & 1 : (cells.high >> (i - 64)) & 1;
+      };
+      char& mark = board_[i / BOARD_SIZE][i % BOARD_SIZE];
+      mark = is_set(hits) ? 'X' : is_set(misses) ? '@' : ' ';
+    }
+    return true;
+  }
+
+  void PrintBoard() {
+    std::cout << "  ";
+    for (char i = 0; i < BOARD_SIZE; ++i) {
+      std::cout << (char)('a' + i) << ' ';
+    }
+    std::cout << '\n';
+    for (int i = 0; i < BOARD_SIZE; ++i) {
+      std::cout << i;
+      for (int j = 0; j < BOARD_SIZE; ++j) {
+        std::cout << ' ' << board_[i][j];
+      }
+      std::cout << '\n';
+    }
+  }
+
   void Attack() {
     std::string attack_pos;
     bool incorrect_input = true;
@@ -24,56 +114,96 @@ class BattleshipClient : public net::IClient<MessageTypes> {
                   << '\n';
       }
     }
+    // Строка уже проверена: ровно две буквы и завершающий ноль
     char buffer[3];
-    strcpy_s(buffer, attack_pos.c_str());
+    std::memcpy(buffer, attack_pos.c_str(), sizeof(buffer));
     net::Message<MessageTypes> message;
     message.header.id = MessageTypes::Attack;
-    message << buffer;
+    net::MessageWriter(message).Write(buffer);
     Send(message);
   }
+
+ private:
+  char board_[BOARD_SIZE][BOARD_SIZE];
 };
 
-int main() {
+// Необязательные аргументы - ID партии, которую нужно продолжить после
+// перезапуска сервера, и код возврата, выданный вместе с ним
+int main(int argc, char* argv[]) {
+  uint32_t reclaim_id = argc > 2 ? std::strtoul(argv[1], nullptr, 10) : 0;
+  uint64_t reclaim_token =
+      argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0;
   BattleshipClient client;
-  client.Connect("tiebetie.servegame.com", 60000);
+  bool quit = !client.Connect("tiebetie.servegame.com", 60000);
 
-  bool quit = false;
   while (!quit) {
-    if (client.IsConnected()) {
-      if (!client.Incoming().Empty()) {
-        auto message = client.Incoming().PopFront().message;
-        switch (message.header.id) {
-
-          case MessageTypes::ServerAccept: {
-            // Server has responded to a ping request
-            std::cout << "Server accept connection!\n";
-            char buffer[1024];
-            message >> buffer;
-            std::cout << buffer << '\n';
-            std::cout
-                << "Answer format is 'XY', where X = a - j, Y = 0 - 9 for "
-                   "example 'a3'\n";
-            client.Attack();
-          } break;
-
-          case MessageTypes::Attack: {
-            char buffer[1024];
-            message >> buffer;
-            std::cout << buffer << "##############################\n";
-
-            client.Attack();
-          } break;
-
-          case MessageTypes::Win: {
-            char buffer[1024];
-            message >> buffer;
-            std::cout << buffer << "##############################\n";
-            quit = true;
-          } break;
+    // Поток спит, пока не придёт сообщение или уведомление об отключении
+    client.Incoming().Wait();
+    auto incoming = client.Incoming().PopFront();
+    if (incoming.disconnected) break;
+
+    auto& message = incoming.message;
+    switch (message.header.id) {
+
+      case MessageTypes::ServerAccept: {
+        // Server has responded to a ping request
+        std::cout << "Server accept connection!\n";
+        uint32_t game_id = 0;
+        uint64_t token = 0;
+        if (net::MessageReader(message).Read(game_id, token)) {
+          std::cout << "Your game id: " << game_id
+                    << ", reclaim code: " << token << "\n";
         }
-      }
-    } else {
-      quit = true;
+        if (reclaim_id != 0) {
+          // Доску покажем, когда сервер ответит
+          client.Reclaim(reclaim_id, reclaim_token);
+          break;
+        }
+        client.PrintBoard();
+        std::cout
+            << "Answer format is 'XY', where X = a - j, Y = 0 - 9 for "
+               "example 'a3'\n";
+        client.Attack();
+      } break;
+
+      case MessageTypes::Attack: {
+        client.ApplyShot(message);
+        client.PrintBoard();
+        std::cout << "##############################\n";
+
+        client.Attack();
+      } break;
+
+      case MessageTypes::Reclaim: {
+        if (client.ApplyReclaim(message)) {
+          std::cout << "Game " << reclaim_id << " is back!\n";
+        } else {
+          std::cout << "Game " << reclaim_id
+                    << " can't be reclaimed, playing a new one\n";
+        }
+        client.PrintBoard();
+        client.Attack();
+      } break;
+
+      case MessageTypes::SpectatorUpdate: {
+        net::MessageReader reader(message);
+        uint32_t game_id = 0;
+        reader.Read(game_id);
+        std::cout << "Game [" << game_id << "]\n"
+                  << reader.ReadString()
+                  << "##############################\n";
+      } break;
+
+      case MessageTypes::Win: {
+        net::MessageReader reader(message);
+        std::cout << reader.ReadString() << reader.ReadString()
+                  << "##############################\n";
+        quit = true;
+      } break;
+
+      // Spectate и StopSpectate шлёт только клиент
+      default:
+        break;
     }
   }
   std::cout << "For exit the game enter anything and press 'ENTER'\n";
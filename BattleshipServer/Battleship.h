@@ -1,98 +1,155 @@
 ﻿#pragma once
 #include <iostream>
-#include <random>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#include "Bitboard.h"
+#include "FleetGenerator.h"
+
 using std::vector;
 
-const uint8_t BOARD_SIZE = 10;
-const uint8_t THE_BIGGEST_SHIP = 4;
+// Результат выстрела: повтор по уже открытой клетке, промах, ранение,
+// потопление
+enum class Shot : uint8_t { repeat, miss, hit, sunk };
+
+// Партия в компактном виде фиксированного размера и без указателей: её
+// можно копировать байтами и хранить прямо в отображённом в память файле
+struct GameSnapshot {
+  static constexpr uint8_t VERTICAL = 0x80;
+
+  // Открытые клетки скрытой доски: попадания и промахи вместе с ореолами
+  // потопленных кораблей
+  Bitboard hits;
+  Bitboard misses;
+  // Корабль - его первая клетка (x * BOARD_SIZE + y) и длина, у
+  // вертикального корабля к длине добавлен VERTICAL
+  struct Ship {
+    uint8_t cell;
+    uint8_t shape;
+  };
+  Ship ships[FLEET_SIZE];
+  // Непотопленные клетки каждого корабля
+  uint8_t lives[FLEET_SIZE];
+  uint8_t win;
+  // Добивает структуру до 64 байт без дыр выравнивания, чтобы побайтовая
+  // контрольная сумма не зависела от мусора в них
+  uint8_t reserved = 0;
+
+  // Снимок мог прийти из файла: корабли должны помещаться на доску, а
+  // отметки - не выходить за неё
+  bool IsValid() const {
+    if ((hits.high | misses.high) & ~Bitboard::HIGH_MASK) return false;
+    for (int id = 0; id < FLEET_SIZE; ++id) {
+      int length = ships[id].shape & ~VERTICAL;
+      int x = ships[id].cell / BOARD_SIZE;
+      int y = ships[id].cell % BOARD_SIZE;
+      int end = (ships[id].shape & VERTICAL ? x : y) + length;
+      if (ships[id].cell >= BOARD_SIZE * BOARD_SIZE || length < 1 ||
+          length > THE_BIGGEST_SHIP || end > BOARD_SIZE ||
+          lives[id] > length) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Fleet ToFleet() const {
+    Fleet fleet;
+    for (int id = 0; id < FLEET_SIZE; ++id) {
+      int step = ships[id].shape & VERTICAL ? BOARD_SIZE : 1;
+      int length = ships[id].shape & ~VERTICAL;
+      for (int i = 0; i < length; ++i) {
+        fleet.ships[id] |= Bitboard::Cell(ships[id].cell + i * step);
+      }
+    }
+    return fleet;
+  }
+};
+static_assert(sizeof(GameSnapshot) == 64 &&
+              std::has_unique_object_representations_v<GameSnapshot>);
 
 class Battleship {
  public:
-  Battleship() : board_(BOARD_SIZE), hiden_board_(BOARD_SIZE) {
+  Battleship()
+      : board_(BOARD_SIZE),
+        hiden_board_(BOARD_SIZE),
+        board_text_(RenderEmpty()),
+        hiden_board_text_(RenderEmpty()) {
     board_.assign(BOARD_SIZE, vector<Cell>(BOARD_SIZE));
     RandomArrangement();
     hiden_board_.assign(BOARD_SIZE, vector<Cell>(BOARD_SIZE));
   }
-  Battleship(const Battleship&) = delete;
-  void Print(bool hiden) {
-    vector<vector<Cell>>* board = &board_;
-    if (hiden) {
-      board = &hiden_board_;
-    }
-
-    std::cout << "  ";
-    for (char i = 0; i < BOARD_SIZE; ++i) {
-      std::cout << (char)('a' + i) << ' ';
-    }
-    std::cout << '\n';
-    for (int i = 0; i < BOARD_SIZE; ++i) {
-      std::cout << i;
-      for (int j = 0; j < BOARD_SIZE; ++j) {
-        std::cout << ' ' << (*board)[i][j].mark;
-      }
-      std::cout << '\n';
-    }
+  explicit Battleship(const Fleet& fleet)
+      : board_(BOARD_SIZE),
+        hiden_board_(BOARD_SIZE),
+        board_text_(RenderEmpty()),
+        hiden_board_text_(RenderEmpty()) {
+    board_.assign(BOARD_SIZE, vector<Cell>(BOARD_SIZE));
+    Arrange(fleet);
+    hiden_board_.assign(BOARD_SIZE, vector<Cell>(BOARD_SIZE));
   }
-  std::string GetBoard(bool hiden) {
-    vector<vector<Cell>>* board = &board_;
-    if (hiden) {
-      board = &hiden_board_;
-    }
-    std::stringstream buffer;
-    buffer << "  ";
-    for (char i = 0; i < BOARD_SIZE; ++i) {
-      buffer << (char)('a' + i) << ' ';
-    }
-    buffer << '\n';
-    for (int i = 0; i < BOARD_SIZE; ++i) {
-      buffer << i;
-      for (int j = 0; j < BOARD_SIZE; ++j) {
-        buffer << ' ' << (*board)[i][j].mark;
-      }
-      buffer << '\n';
+  // Восстанавливает партию из снимка, проверенного GameSnapshot::IsValid
+  explicit Battleship(const GameSnapshot& snapshot)
+      : Battleship(snapshot.ToFleet()) {
+    snapshot.hits.ForEach([&](int index) {
+      SetMark(hiden_board_, hiden_board_text_, index / BOARD_SIZE,
+              index % BOARD_SIZE, 'X');
+    });
+    snapshot.misses.ForEach([&](int index) {
+      SetMark(hiden_board_, hiden_board_text_, index / BOARD_SIZE,
+              index % BOARD_SIZE, '@');
+    });
+    ships_alive_count_ = 0;
+    for (int id = 0; id < FLEET_SIZE; ++id) {
+      ships_lifes_[id] = snapshot.lives[id];
+      if (ships_lifes_[id] > 0) ++ships_alive_count_;
     }
-    return buffer.str();
-  }
-  void RandomArrangement() {
-    int iteration = 0;
-    for (int ship_type = 0; ship_type < THE_BIGGEST_SHIP; ++ship_type) {
-      // Чем больше корабли, тем меньше их количество.
-      for (int ship_iter = 0; ship_iter < THE_BIGGEST_SHIP - ship_type;
-           ++ship_iter) {
-        bool is_placed = false;
-        while (!is_placed) {
-          // Пусть корабль стоит вертикально, значит ограничиваем x
-          // Ограничиваем для того, чтобы случайно не попасть за пределы доски
-          int x_max = BOARD_SIZE - 1 - ship_type;
-          int y_max = BOARD_SIZE - 1;
-          bool is_vertical = UniformDist(false, true);
-          if (!is_vertical) {
-            std::swap(x_max, y_max);
-          }
-          is_placed = TryPlaceShip(UniformDist(0, x_max), UniformDist(0, y_max),
-                                   ship_type, ship_iter, is_vertical);
-          if (++iteration > 1000 && !is_placed) {
-            Clear(board_);
-            ship_type = 0;
-            ship_iter = 0;
-            iteration = 0;
-            std::cout << "Refresh, iteration count > 1000\n";
+    win_ = snapshot.win;
+  }
+  Battleship(const Battleship&) = delete;
+  void Print(bool hiden) { std::cout << GetBoard(hiden); }
+  // Текст доски хранится готовым и правится по клетке при каждом ходе, так
+  // что здесь нет ни отрисовки, ни выделения памяти. Представление
+  // действительно, пока жива партия
+  std::string_view GetBoard(bool hiden) const {
+    return hiden ? hiden_board_text_ : board_text_;
+  }
+  void RandomArrangement() { Arrange(FleetGenerator::Generate()); }
+  // Расставляет готовый флот: корабли 'X' и клетки вокруг них '@'
+  void Arrange(const Fleet& fleet) {
+    Clear(board_, board_text_);
+    ships_lifes_.clear();
+    ships_alive_count_ = 0;
+    win_ = false;
+    for (int id = 0; id < FLEET_SIZE; ++id) {
+      fleet.ships[id].ForEach([&](int index) {
+        int x = index / BOARD_SIZE;
+        int y = index % BOARD_SIZE;
+        for (int i = x - 1; i <= x + 1; ++i) {
+          for (int j = y - 1; j <= y + 1; ++j) {
+            if (CheckBoardLimit(i, j) && board_[i][j].mark == ' ') {
+              SetMark(board_, board_text_, i, j, '@');
+            }
           }
         }
-      }
+        SetMark(board_, board_text_, x, y, 'X');
+        board_[x][y].id = id;
+      });
+      // Массив нужен нам, чтобы понять, когда корабль будет уничтожен
+      ships_lifes_.push_back(fleet.ships[id].Count());
+      ++ships_alive_count_;
     }
-    std::cout << "Iteration count: " << iteration << '\n';
   }
-  void Attack(const std::string& attack) {
+  // В revealed (если передан) попадают клетки вокруг потопленного корабля,
+  // открытые этим выстрелом
+  Shot Attack(const std::string& attack, Bitboard* revealed = nullptr) {
     char x = attack.at(1) - '0';
     char y = attack.at(0) - 'a';
     if (hiden_board_[x][y].mark == ' ') {
       if (board_[x][y].mark == 'X') {
-        hiden_board_[x][y].mark = 'X';
+        SetMark(hiden_board_, hiden_board_text_, x, y, 'X');
 
         if (--ships_lifes_[board_[x][y].id] == 0) {
           if (--ships_alive_count_ == 0) {
@@ -100,102 +157,133 @@ class Battleship {
           }
           vector<vector<bool>> visited(BOARD_SIZE, vector<bool>());
           visited.assign(BOARD_SIZE, vector<bool>(BOARD_SIZE));
-          Brush(x, y, visited);
+          Brush(x, y, visited, revealed);
+          return Shot::sunk;
         }
+        return Shot::hit;
       } else {
-        hiden_board_[x][y].mark = '@';
+        SetMark(hiden_board_, hiden_board_text_, x, y, '@');
+        return Shot::miss;
       }
     }
+    return Shot::repeat;
   }
   bool CheckWin() { return win_; }
+  // Снимок партии, обратный конструктору из GameSnapshot
+  void Save(GameSnapshot& snapshot) const {
+    snapshot = GameSnapshot{};
+    for (int x = 0; x < BOARD_SIZE; ++x) {
+      for (int y = 0; y < BOARD_SIZE; ++y) {
+        int index = x * BOARD_SIZE + y;
+        if (hiden_board_[x][y].mark == 'X') {
+          snapshot.hits |= Bitboard::Cell(index);
+        } else if (hiden_board_[x][y].mark == '@') {
+          snapshot.misses |= Bitboard::Cell(index);
+        }
 
- private:
-  int UniformDist(int from, int to) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distrib(from, to);
-    return distrib(gen);
-  }
-  bool CheckCollision(int x, int y, int ship_type, bool is_vertical) {
-    for (int i = x; i <= x + is_vertical * ship_type; ++i) {
-      for (int j = y; j <= y + !is_vertical * ship_type; ++j) {
-        if (board_[i][j].mark != ' ') {
-          return false;
+        int id = GetShipId(x, y);
+        if (id < 0) continue;
+        GameSnapshot::Ship& ship = snapshot.ships[id];
+        // Клетки обходятся по возрастанию, первая встреченная - начало
+        if (ship.shape == 0) {
+          ship.cell = static_cast<uint8_t>(index);
+        } else if (index == ship.cell + BOARD_SIZE) {
+          ship.shape |= GameSnapshot::VERTICAL;
         }
+        ++ship.shape;
       }
     }
-    return true;
+    for (int id = 0; id < FLEET_SIZE; ++id) {
+      snapshot.lives[id] = static_cast<uint8_t>(ships_lifes_[id]);
+    }
+    snapshot.win = win_;
+  }
+  // Номер корабля в клетке или -1, если корабля там нет
+  int GetShipId(int x, int y) const {
+    return board_[x][y].mark == 'X' ? board_[x][y].id : -1;
   }
+
+ private:
   bool CheckBoardLimit(int x, int y) {
     return 0 <= x && x < BOARD_SIZE && 0 <= y && y < BOARD_SIZE;
   }
   bool CheckShipContinue(int x, int y) {
     return CheckBoardLimit(x, y) && board_[x][y].mark == 'X';
   }
-  void Brush(int x, int y, vector<vector<bool>>& visited) {
+  void Brush(int x, int y, vector<vector<bool>>& visited,
+             Bitboard* revealed) {
     visited[x][y] = true;
     if (CheckShipContinue(x, y + 1) && !visited[x][y + 1]) {
-      Brush(x, y + 1, visited);
+      Brush(x, y + 1, visited, revealed);
     }
     if (CheckShipContinue(x, y - 1) && !visited[x][y - 1]) {
-      Brush(x, y - 1, visited);
+      Brush(x, y - 1, visited, revealed);
     }
     if (CheckShipContinue(x + 1, y) && !visited[x + 1][y]) {
-      Brush(x + 1, y, visited);
+      Brush(x + 1, y, visited, revealed);
     }
     if (CheckShipContinue(x - 1, y) && !visited[x - 1][y]) {
-      Brush(x - 1, y, visited);
+      Brush(x - 1, y, visited, revealed);
     }
 
     for (int i = x - 1; i <= x + 1; ++i) {
       for (int j = y - 1; j <= y + 1; ++j) {
         if (CheckBoardLimit(i, j) && hiden_board_[i][j].mark == ' ') {
-          hiden_board_[i][j].mark = '@';
+          SetMark(hiden_board_, hiden_board_text_, i, j, '@');
+          if (revealed) *revealed |= Bitboard::Cell(i * BOARD_SIZE + j);
         }
       }
     }
   }
-  bool TryPlaceShip(int x, int y, int ship_type, int ship_iter,
-                    bool is_vertical) {
-    int ship_id = ships_lifes_.size();
-    if (CheckCollision(x, y, ship_type, is_vertical)) {
-      for (int i = x - 1; i <= x + is_vertical * ship_type + 1; ++i) {
-        for (int j = y - 1; j <= y + !is_vertical * ship_type + 1; ++j) {
-          if (0 <= i && i < BOARD_SIZE && 0 <= j && j < BOARD_SIZE) {
-            board_[i][j].mark = '@';
-          }
-        }
-      }
-      for (int i = x; i <= x + is_vertical * ship_type; ++i) {
-        for (int j = y; j <= y + !is_vertical * ship_type; ++j) {
-          board_[i][j].mark = 'X';
-          board_[i][j].id = ships_lifes_.size();
-        }
-      }
-      ++ships_alive_count_;
-    } else {
-      return false;
-    }
-    // Массив нужен нам, чтобы понять, когда корабль будет уничтожен
-    ships_lifes_.push_back(ship_type + 1);
-    return true;
-  }
 
  private:
   struct Cell {
     int id = -1;
     char mark = ' ';
   };
-  void Clear(vector<vector<Cell>>& board) {
+  // Заголовок "  a b ... j \n", затем строки вида "0 X @ ... \n"
+  static const size_t TEXT_HEADER_SIZE = 3 + 2 * BOARD_SIZE;
+  static const size_t TEXT_ROW_SIZE = 2 + 2 * BOARD_SIZE;
+
+  static size_t TextOffset(int x, int y) {
+    return TEXT_HEADER_SIZE + x * TEXT_ROW_SIZE + 2 + 2 * y;
+  }
+  static std::string RenderEmpty() {
+    std::string text;
+    text.reserve(TEXT_HEADER_SIZE + BOARD_SIZE * TEXT_ROW_SIZE);
+    text += "  ";
+    for (char i = 0; i < BOARD_SIZE; ++i) {
+      text += (char)('a' + i);
+      text += ' ';
+    }
+    text += '\n';
+    for (int i = 0; i < BOARD_SIZE; ++i) {
+      text += (char)('0' + i);
+      for (int j = 0; j < BOARD_SIZE; ++j) {
+        text += "  ";
+      }
+      text += '\n';
+    }
+    return text;
+  }
+  // Меняет клетку доски и сразу её символ в тексте
+  void SetMark(vector<vector<Cell>>& board, std::string& text, int x, int y,
+               char mark) {
+    board[x][y].mark = mark;
+    text[TextOffset(x, y)] = mark;
+  }
+  void Clear(vector<vector<Cell>>& board, std::string& text) {
     for (int i = 0; i < BOARD_SIZE; ++i) {
       for (int j = 0; j < BOARD_SIZE; ++j) {
         board[i][j].id = -1;
-        board[i][j].mark = ' ';
+        SetMark(board, text, i, j, ' ');
       }
     }
   }
   vector<vector<Cell>> board_;
   vector<vector<Cell>> hiden_board_;
+  std::string board_text_;
+  std::string hiden_board_text_;
   vector<int> ships_lifes_;
   int ships_alive_count_ = 0;
   int ship_alive_ = 0;
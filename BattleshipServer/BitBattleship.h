@@ -0,0 +1,136 @@
+﻿#pragma once
+#include <cstdint>
+#include <string>
+
+#include "Battleship.h"
+#include "Bitboard.h"
+#include "FleetGenerator.h"
+
+// Та же игра, что и Battleship, но корабли, попадания, промахи и ореолы
+// хранятся битовыми масками: ход, проверка потопления и победы обходятся
+// несколькими битовыми операциями без выделения памяти. Результаты ходов и
+// вывод доски совпадают с Battleship, так что движки можно сверять
+class BitBattleship {
+ public:
+  BitBattleship() : BitBattleship(FleetGenerator::Generate()) {}
+
+  explicit BitBattleship(const Fleet& fleet) {
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+      ship_of_cell_[i] = -1;
+    }
+    for (int id = 0; id < FLEET_SIZE; ++id) {
+      ships_[id] = fleet.ships[id];
+      ships_[id].ForEach([&](int index) { ship_of_cell_[index] = id; });
+      fleet_ |= ships_[id];
+      halos_[id] = Dilate(ships_[id]) & ~ships_[id];
+      placement_halo_ |= halos_[id];
+    }
+  }
+
+  // Берёт расстановку кораблей у обычного движка
+  explicit BitBattleship(const Battleship& game)
+      : BitBattleship(FleetOf(game)) {}
+
+  void Attack(const std::string& attack) {
+    Attack(attack.at(1) - '0', attack.at(0) - 'a');
+  }
+
+  Shot Attack(int x, int y) {
+    int index = x * BOARD_SIZE + y;
+    if ((hits_ | misses_).Test(index)) {
+      return Shot::repeat;
+    }
+
+    Bitboard cell = Bitboard::Cell(index);
+    if (!(fleet_ & cell).Any()) {
+      misses_ |= cell;
+      return Shot::miss;
+    }
+
+    hits_ |= cell;
+    int id = ship_of_cell_[index];
+    if (!(ships_[id] & ~hits_).Any()) {
+      misses_ |= halos_[id];
+      return Shot::sunk;
+    }
+    return Shot::hit;
+  }
+
+  bool CheckWin() const { return hits_ == fleet_; }
+
+  std::string GetBoard(bool hiden) const {
+    std::string buffer;
+    buffer.reserve(3 + 2 * BOARD_SIZE + BOARD_SIZE * (2 + 2 * BOARD_SIZE));
+    buffer += "  ";
+    for (char i = 0; i < BOARD_SIZE; ++i) {
+      buffer += (char)('a' + i);
+      buffer += ' ';
+    }
+    buffer += '\n';
+    for (int i = 0; i < BOARD_SIZE; ++i) {
+      buffer += (char)('0' + i);
+      for (int j = 0; j < BOARD_SIZE; ++j) {
+        buffer += ' ';
+        buffer += GetMark(i * BOARD_SIZE + j, hiden);
+      }
+      buffer += '\n';
+    }
+    return buffer;
+  }
+
+  // Ореол корабля под номером id (клетки вокруг него)
+  Bitboard GetHalo(int id) const { return halos_[id]; }
+  Bitboard GetHits() const { return hits_; }
+  Bitboard GetMisses() const { return misses_; }
+
+ private:
+  char GetMark(int index, bool hiden) const {
+    if (hiden) {
+      if (hits_.Test(index)) return 'X';
+      if (misses_.Test(index)) return '@';
+      return ' ';
+    }
+    // Полная доска, как у Battleship: корабли и ореолы расстановки
+    if (fleet_.Test(index)) return 'X';
+    if (placement_halo_.Test(index)) return '@';
+    return ' ';
+  }
+
+  static Fleet FleetOf(const Battleship& game) {
+    Fleet fleet;
+    for (int x = 0; x < BOARD_SIZE; ++x) {
+      for (int y = 0; y < BOARD_SIZE; ++y) {
+        int id = game.GetShipId(x, y);
+        if (id >= 0) fleet.ships[id] |= Bitboard::Cell(x * BOARD_SIZE + y);
+      }
+    }
+    return fleet;
+  }
+
+  // Расширяет маску на все соседние клетки, включая диагональные
+  static Bitboard Dilate(const Bitboard& board) {
+    Bitboard result;
+    for (int x = 0; x < BOARD_SIZE; ++x) {
+      for (int y = 0; y < BOARD_SIZE; ++y) {
+        if (!board.Test(x * BOARD_SIZE + y)) continue;
+        for (int i = x - 1; i <= x + 1; ++i) {
+          for (int j = y - 1; j <= y + 1; ++j) {
+            if (0 <= i && i < BOARD_SIZE && 0 <= j && j < BOARD_SIZE) {
+              result |= Bitboard::Cell(i * BOARD_SIZE + j);
+            }
+          }
+        }
+      }
+    }
+    return result;
+  }
+
+  Bitboard ships_[FLEET_SIZE];
+  Bitboard halos_[FLEET_SIZE];
+  Bitboard fleet_;
+  Bitboard placement_halo_;
+  Bitboard hits_;
+  // Промахи вместе с ореолами потопленных кораблей
+  Bitboard misses_;
+  int8_t ship_of_cell_[BOARD_SIZE * BOARD_SIZE];
+};
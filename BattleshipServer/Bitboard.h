@@ -0,0 +1,62 @@
+﻿#pragma once
+#include <bit>
+#include <cstdint>
+
+const uint8_t BOARD_SIZE = 10;
+const uint8_t THE_BIGGEST_SHIP = 4;
+// Кораблей длины k ровно THE_BIGGEST_SHIP - k + 1 штук
+const uint8_t FLEET_SIZE = THE_BIGGEST_SHIP * (THE_BIGGEST_SHIP + 1) / 2;
+
+// 100 клеток поля 10x10 в двух 64-битных словах, клетка (x, y) имеет номер
+// x * BOARD_SIZE + y
+struct Bitboard {
+  uint64_t low = 0;
+  uint64_t high = 0;
+
+  static constexpr uint64_t HIGH_MASK = (uint64_t(1) << 36) - 1;
+
+  static constexpr Bitboard Cell(int index) {
+    Bitboard board;
+    if (index < 64) {
+      board.low = uint64_t(1) << index;
+    } else {
+      board.high = uint64_t(1) << (index - 64);
+    }
+    return board;
+  }
+
+  constexpr bool Test(int index) const {
+    return index < 64 ? (low >> index) & 1 : (high >> (index - 64)) & 1;
+  }
+  constexpr bool Any() const { return low | high; }
+  constexpr int Count() const {
+    return std::popcount(low) + std::popcount(high);
+  }
+
+  // Вызывает f(index) для каждой установленной клетки
+  template <typename F>
+  void ForEach(F f) const {
+    for (uint64_t bits = low; bits; bits &= bits - 1) {
+      f(std::countr_zero(bits));
+    }
+    for (uint64_t bits = high; bits; bits &= bits - 1) {
+      f(64 + std::countr_zero(bits));
+    }
+  }
+
+  constexpr Bitboard operator|(const Bitboard& other) const {
+    return {low | other.low, high | other.high};
+  }
+  constexpr Bitboard operator&(const Bitboard& other) const {
+    return {low & other.low, high & other.high};
+  }
+  constexpr Bitboard operator~() const { return {~low, ~high & HIGH_MASK}; }
+  constexpr Bitboard& operator|=(const Bitboard& other) {
+    low |= other.low;
+    high |= other.high;
+    return *this;
+  }
+  constexpr bool operator==(const Bitboard& other) const {
+    return low == other.low && high == other.high;
+  }
+};
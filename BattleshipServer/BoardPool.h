@@ -0,0 +1,135 @@
+﻿#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Log.h>
+#include <Metrics.h>
+
+// Запас заранее созданных партий. Фоновый поток держит в пуле до capacity
+// досок и начинает пополнение, как только их становится меньше low_water,
+// так что при подключении клиента доска просто забирается из пула
+template <typename Game>
+class BoardPool {
+ public:
+  struct Stats {
+    size_t depth = 0;
+    // Минимальная глубина пула с прошлого пополнения
+    size_t min_depth = 0;
+    uint64_t pops = 0;
+    // Пул был пуст, и доску пришлось создавать на месте
+    uint64_t misses = 0;
+    std::chrono::microseconds last_refill{0};
+    std::chrono::microseconds max_refill{0};
+  };
+
+ public:
+  BoardPool(size_t capacity = 1024, size_t low_water = 256)
+      : capacity_(capacity), low_water_(std::min(low_water, capacity)) {
+    boards_.reserve(capacity_);
+    min_depth_ = capacity_;
+    refill_thread_ = std::thread([this]() { Refill(); });
+  }
+  BoardPool(const BoardPool&) = delete;
+
+  ~BoardPool() {
+    {
+      std::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    need_refill_.notify_one();
+    if (refill_thread_.joinable()) refill_thread_.join();
+  }
+
+  std::unique_ptr<Game> Pop() {
+    {
+      std::unique_lock lock(mutex_);
+      ++pops_;
+      if (!boards_.empty()) {
+        auto game = std::move(boards_.back());
+        boards_.pop_back();
+        min_depth_ = std::min(min_depth_, boards_.size());
+        bool refill = boards_.size() < low_water_;
+        lock.unlock();
+        if (refill) need_refill_.notify_one();
+        return game;
+      }
+      ++misses_;
+      min_depth_ = 0;
+    }
+    need_refill_.notify_one();
+    return Generate();
+  }
+
+  Stats GetStats() {
+    std::scoped_lock lock(mutex_);
+    Stats stats;
+    stats.depth = boards_.size();
+    stats.min_depth = min_depth_;
+    stats.pops = pops_;
+    stats.misses = misses_;
+    stats.last_refill = last_refill_;
+    stats.max_refill = max_refill_;
+    return stats;
+  }
+
+ private:
+  // Время создания каждой доски попадает в гистограмму board_generation
+  static std::unique_ptr<Game> Generate() {
+    static const auto board_generation =
+        net::Metrics::AddHistogram("board_generation");
+    auto start = net::Metrics::Clock::now();
+    auto game = std::make_unique<Game>();
+    net::Metrics::Record(board_generation,
+                         net::Metrics::Clock::now() - start);
+    return game;
+  }
+
+  void Refill() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+      need_refill_.wait(lock, [this]() {
+        return stop_ || boards_.size() < low_water_;
+      });
+      if (stop_) return;
+
+      auto start = std::chrono::steady_clock::now();
+      size_t created = 0;
+      while (!stop_ && boards_.size() < capacity_) {
+        // Доску создаём без блокировки, чтобы не задерживать Pop()
+        lock.unlock();
+        auto game = Generate();
+        lock.lock();
+        boards_.push_back(std::move(game));
+        ++created;
+      }
+
+      last_refill_ = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+      max_refill_ = std::max(max_refill_, last_refill_);
+      net::Log::Info(
+          "[BoardPool] Refilled {} boards in {} us, min depth {}, misses {}",
+          created, last_refill_.count(), min_depth_, misses_);
+      min_depth_ = boards_.size();
+    }
+  }
+
+  const size_t capacity_;
+  const size_t low_water_;
+
+  std::mutex mutex_;
+  std::condition_variable need_refill_;
+  std::vector<std::unique_ptr<Game>> boards_;
+  bool stop_ = false;
+
+  size_t min_depth_ = 0;
+  uint64_t pops_ = 0;
+  uint64_t misses_ = 0;
+  std::chrono::microseconds last_refill_{0};
+  std::chrono::microseconds max_refill_{0};
+
+  std::thread refill_thread_;
+};
@@ -0,0 +1,158 @@
+﻿#pragma once
+#include <cstdint>
+#include <random>
+#include <span>
+
+#include "Bitboard.h"
+
+// Быстрый генератор псевдослучайных чисел (splitmix64), по одному на поток
+class FastRandom {
+ public:
+  explicit FastRandom(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+  }
+
+  // Равномерное число из [0, n) без смещения (метод Лемира)
+  uint32_t Below(uint32_t n) {
+    uint64_t m = (Next() >> 32) * n;
+    uint32_t low = uint32_t(m);
+    if (low < n) {
+      uint32_t threshold = uint32_t(-n) % n;
+      while (low < threshold) {
+        m = (Next() >> 32) * n;
+        low = uint32_t(m);
+      }
+    }
+    return uint32_t(m >> 32);
+  }
+
+  // random_device дёргаем только один раз за жизнь потока
+  static FastRandom& ForThread() {
+    thread_local FastRandom random(
+        (uint64_t(std::random_device()()) << 32) ^ std::random_device()());
+    return random;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// Расстановка флота: клетки каждого корабля. Номера кораблей такие же, как
+// в Battleship: сначала однопалубные, в конце четырёхпалубный
+struct Fleet {
+  Bitboard ships[FLEET_SIZE];
+};
+
+// Положение корабля и его запретная зона (сам корабль и клетки вокруг)
+struct ShipPlacement {
+  Bitboard ship;
+  Bitboard zone;
+};
+
+// Положений больше всего у двухпалубника: 2 * 10 * 9
+const int MAX_PLACEMENTS = 2 * BOARD_SIZE * (BOARD_SIZE - 1);
+
+// Все допустимые положения кораблей каждой длины
+struct PlacementTable {
+  ShipPlacement placements[THE_BIGGEST_SHIP][MAX_PLACEMENTS];
+  int count[THE_BIGGEST_SHIP] = {};
+};
+
+constexpr PlacementTable MakePlacementTable() {
+  PlacementTable table;
+  for (int ship_type = 0; ship_type < THE_BIGGEST_SHIP; ++ship_type) {
+    // Однопалубный корабль в обеих ориентациях один и тот же
+    for (int is_vertical = 0; is_vertical < (ship_type ? 2 : 1);
+         ++is_vertical) {
+      for (int x = 0; x + is_vertical * ship_type < BOARD_SIZE; ++x) {
+        for (int y = 0; y + !is_vertical * ship_type < BOARD_SIZE; ++y) {
+          ShipPlacement placement;
+          for (int i = x; i <= x + is_vertical * ship_type; ++i) {
+            for (int j = y; j <= y + !is_vertical * ship_type; ++j) {
+              placement.ship |= Bitboard::Cell(i * BOARD_SIZE + j);
+            }
+          }
+          for (int i = x - 1; i <= x + is_vertical * ship_type + 1; ++i) {
+            for (int j = y - 1; j <= y + !is_vertical * ship_type + 1; ++j) {
+              if (0 <= i && i < BOARD_SIZE && 0 <= j && j < BOARD_SIZE) {
+                placement.zone |= Bitboard::Cell(i * BOARD_SIZE + j);
+              }
+            }
+          }
+          table.placements[ship_type][table.count[ship_type]++] = placement;
+        }
+      }
+    }
+  }
+  return table;
+}
+
+// Таблица считается на этапе компиляции
+inline constexpr PlacementTable PLACEMENTS = MakePlacementTable();
+
+// Генератор расстановок. Проверка положения корабля по таблице сводится к
+// одному AND с запретными зонами уже стоящих кораблей
+class FleetGenerator {
+ public:
+  // Каждый корабль ставится равновероятно в любое из допустимых при уже
+  // стоящих кораблях положений, как и в прежнем RandomArrangement, но без
+  // перебора случайных неудачных попыток
+  static Fleet Generate(FastRandom& random = FastRandom::ForThread()) {
+    Fleet fleet;
+    while (!TryGenerate(random, fleet)) {
+    }
+    return fleet;
+  }
+
+  // Пакетная генерация множества расстановок подряд
+  static void Generate(std::span<Fleet> fleets,
+                       FastRandom& random = FastRandom::ForThread()) {
+    for (auto& fleet : fleets) {
+      while (!TryGenerate(random, fleet)) {
+      }
+    }
+  }
+
+ private:
+  // false, если очередному кораблю не осталось места и нужно начать заново
+  static bool TryGenerate(FastRandom& random, Fleet& fleet) {
+    Bitboard blocked;
+    int id = 0;
+    for (int ship_type = 0; ship_type < THE_BIGGEST_SHIP; ++ship_type) {
+      const ShipPlacement* placements = PLACEMENTS.placements[ship_type];
+      uint32_t count = PLACEMENTS.count[ship_type];
+
+      for (int ship_iter = 0; ship_iter < THE_BIGGEST_SHIP - ship_type;
+           ++ship_iter) {
+        int chosen = -1;
+        // Обычно свободно большинство положений, и пара попыток находит
+        // подходящее
+        for (int attempt = 0; attempt < 16 && chosen < 0; ++attempt) {
+          uint32_t i = random.Below(count);
+          if (!(placements[i].ship & blocked).Any()) chosen = i;
+        }
+        // Иначе выбираем из явного списка допустимых положений
+        if (chosen < 0) {
+          uint8_t legal[MAX_PLACEMENTS];
+          uint32_t legal_count = 0;
+          for (uint32_t i = 0; i < count; ++i) {
+            if (!(placements[i].ship & blocked).Any()) {
+              legal[legal_count++] = i;
+            }
+          }
+          if (legal_count == 0) return false;
+          chosen = legal[random.Below(legal_count)];
+        }
+
+        fleet.ships[id++] = placements[chosen].ship;
+        blocked |= placements[chosen].zone;
+      }
+    }
+    return true;
+  }
+};
@@ -1,86 +1,442 @@
-﻿#include <net.h>
+﻿#include <Net.h>
 
-#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
 
 #include "Battleship.h"
+#include "BoardPool.h"
+#include "SessionFile.h"
 
 using std::string;
 
 enum class MessageTypes : uint32_t {
+  // В теле ID партии клиента, по нему за ней могут следить зрители, и
+  // секрет, с которым только сам игрок может вернуть её через Reclaim
   ServerAccept,
   Battleship,
   Win,
+  // Зритель просит показывать ему партию с указанным ID
+  Spectate,
+  StopSpectate,
+  SpectatorUpdate,
+  // Игрок после перезапуска сервера просит вернуть ему партию: в теле её
+  // ID и секрет из ServerAccept. В ответе ID (0 - отказ) и открытые
+  // клетки: попадания и промахи
+  Reclaim,
+};
+
+// Ответ на выстрел вместо всей доски: клиент сам ведёт у себя модель доски.
+// Если корабль потоплен, следом в сообщение кладётся Bitboard клеток,
+// открытых вокруг корабля
+struct ShotResult {
+  uint8_t x = 0;
+  uint8_t y = 0;
+  Shot shot = Shot::repeat;
 };
 
 class BattleshipServer : public net::IServer<MessageTypes> {
  public:
-  BattleshipServer(uint16_t nPort)
-      : net::IServer<MessageTypes>(nPort) {}
+  // Пул досок стоит рассчитывать на пиковый поток подключений: см. min depth
+  // и misses в отчётах о пополнении. Партии с номером ячейки от
+  // sessions_capacity и выше в файл сессий не попадают
+  BattleshipServer(uint16_t nPort, const std::string& sessions_path,
+                   size_t sessions_capacity = 65536,
+                   size_t boards_capacity = 1024,
+                   size_t boards_low_water = 256)
+      : net::IServer<MessageTypes>(nPort,
+                                   std::thread::hardware_concurrency()),
+        board_pool_(boards_capacity, boards_low_water),
+        sessions_(sessions_path,
+                  std::min<size_t>(sessions_capacity, Games::MAX_SLOTS)) {
+    RestoreSessions();
+  }
+  // Останавливаем потоки, пока партии и файл сессий ещё живы
+  ~BattleshipServer() { Stop(); }
+
+  // Восстановленные партии, которые за это время никто не забрал,
+  // удаляются вместе с их записями
+  void ReleaseUnclaimed() {
+    std::unique_lock lock(games_mutex_);
+    for (uint32_t game_id : unclaimed_) {
+      auto found = games_.Find(game_id);
+      if (!found || *found) continue;
+      games_.Erase(game_id);
+      sessions_.Erase(Games::IndexOf(game_id));
+      net::Metrics::Add(games_finished_);
+    }
+    unclaimed_.clear();
+  }
 
  protected:
   // Переопределяем методы так, как нужно для работы Морского Боя
   virtual bool OnClientConnect(
       std::shared_ptr<net::Connection<MessageTypes>> client) {
+    // Здесь только занимаем ID партии: доску клиент получит первым ходом,
+    // и зрителю, который не играет, она не достаётся вовсе
+    uint32_t game_id = Games::NULL_HANDLE;
+    {
+      std::unique_lock lock(games_mutex_);
+      game_id = games_.Insert(nullptr);
+    }
+    if (game_id == Games::NULL_HANDLE) return false;
+    client->SetSession(game_id);
+    client->SetSendLimits(MakeSendLimits());
+    return true;
+  }
+
+  // Вызывается в strand клиента, когда его сессия закончилась
+  virtual void OnClientDisconnect(
+      std::shared_ptr<net::Connection<MessageTypes>> client) {
+    net::Log::Info("Removing client [{}]", client->GetID());
+    FinishGame(client->GetSession());
+  }
+
+  // Вся партия игрока - одна корутина в strand его соединения. Ходы
+  // приходят в неё прямо из чтения сокета, без очереди и без
+  // потока-обработчика, и партию, кроме неё, никто не меняет
+  virtual Session OnClientSession(
+      std::shared_ptr<net::Connection<MessageTypes>> client) {
+    uint32_t game_id = client->GetSession();
+    // Секрет знают только эта сессия и файл сессий
+    uint64_t token = MakeToken();
+    Battleship* game = nullptr;
+    // Партии, за которыми следит клиент: по окончании сессии он уходит из
+    // их зрителей, даже если эти партии сейчас стоят
+    std::vector<uint32_t> watched;
+
+    // Начальная доска пустая, клиент рисует её сам
+    net::Message<MessageTypes> accept;
+    accept.header.id = MessageTypes::ServerAccept;
+    net::MessageWriter(accept).Write(game_id).Write(token);
+    co_await client->AsyncSend(accept);
+
+    while (auto user_msg = co_await client->Receive()) {
+      switch (user_msg->header.id) {
+        case MessageTypes::Battleship: {
+          net::MessageReader reader(*user_msg);
+          char attack_pos[3];
+          if (!reader.Read(attack_pos) || !IsCell(attack_pos)) break;
+          // После победы ID освобождён, и новая партия не начнётся
+          if (!game) game = StartGame(game_id);
+          if (!game) break;
 
-    // Создаём игру для нового клиента
-    auto game = new Battleship();
-    games_.push_back(game);
-    std::cout << game->GetBoard(false);
+          // Медленный игрок придерживает только свою сессию
+          co_await client->AsyncSend(MakeMoveResult(*game, attack_pos));
+
+          BroadcastToSpectators(game_id, *game);
+          // Законченную партию сразу освобождаем
+          if (game->CheckWin()) {
+            FinishGame(game_id);
+            game = nullptr;
+          } else {
+            // Запись партии меняет только её сессия, блокировка не нужна
+            sessions_.Store(Games::IndexOf(game_id), game_id, token, *game);
+          }
+        } break;
+
+        case MessageTypes::Reclaim: {
+          uint32_t reclaim_id = 0;
+          uint64_t reclaim_token = 0;
+          if (!net::MessageReader(*user_msg).Read(reclaim_id, reclaim_token)) {
+            break;
+          }
+          Battleship* reclaimed = Reclaim(reclaim_id, reclaim_token);
+          // Выданная при подключении партия больше не нужна
+          if (reclaimed) {
+            FinishGame(game_id);
+            game_id = reclaim_id;
+            token = reclaim_token;
+            game = reclaimed;
+            client->SetSession(game_id);
+          }
+          co_await client->AsyncSend(
+              MakeReclaimResult(reclaimed ? game_id : 0, reclaimed));
+        } break;
+
+        case MessageTypes::Spectate: {
+          uint32_t watched_id = 0;
+          if (!net::MessageReader(*user_msg).Read(watched_id)) break;
+          if (Spectate(client, watched_id)) watched.push_back(watched_id);
+        } break;
+
+        case MessageTypes::StopSpectate: {
+          uint32_t watched_id = 0;
+          if (!net::MessageReader(*user_msg).Read(watched_id)) break;
+          StopSpectate(client, watched_id);
+          std::erase(watched, watched_id);
+        } break;
+      }
+    }
+
+    for (uint32_t watched_id : watched) StopSpectate(client, watched_id);
+  }
+
+  // Выдаёт доску под занятый при подключении ID. Готовая игра берётся из
+  // пула, чтобы не расставлять корабли в потоке ввода-вывода
+  Battleship* StartGame(uint32_t game_id) {
+    auto game = board_pool_.Pop();
+    Battleship* started = game.get();
+    {
+      std::unique_lock lock(games_mutex_);
+      auto found = games_.Find(game_id);
+      if (!found || *found) return nullptr;
+      *found = std::move(game);
+    }
+    net::Metrics::Add(games_started_);
+
+    if (net::Log::Enabled(net::Log::level::debug)) {
+      // Запись лога короткая, поэтому доска выводится построчно
+      std::string_view board = started->GetBoard(false);
+      for (size_t begin = 0, end = 0; begin < board.size(); begin = end + 1) {
+        end = std::min(board.find('\n', begin), board.size());
+        net::Log::Debug("[{}] {}", game_id,
+                        board.substr(begin, end - begin));
+      }
+    }
+    return started;
+  }
+
+  // Поднимает партии из файла сессий. Сами доски не собираются: в таблицу
+  // кладутся пустые места под прежними ID, а партия читается из файла,
+  // когда игрок за ней вернётся, так что запуск стоит один проход по файлу
+  void RestoreSessions() {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<size_t, uint32_t>> stale;
+    sessions_.ForEach([&](size_t index, uint32_t game_id) {
+      if (Games::IndexOf(game_id) == index &&
+          games_.Restore(game_id, nullptr)) {
+        unclaimed_.push_back(game_id);
+      } else {
+        stale.emplace_back(index, game_id);
+      }
+    });
+    // Запись с ID не своей ячейки никто не заберёт
+    for (auto [index, game_id] : stale) sessions_.Erase(index);
+    net::Metrics::Add(games_started_, unclaimed_.size());
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    net::Log::Info("[Sessions] Restored {} games in {} us", unclaimed_.size(),
+                   elapsed.count());
+  }
+
+  // Отдаёт восстановленную партию её владельцу, если её ещё никто не
+  // забрал. У места, занятого при подключении, записи в файле нет, и его
+  // не отдать
+  Battleship* Reclaim(uint32_t game_id, uint64_t token) {
+    std::unique_lock lock(games_mutex_);
+    auto found = games_.Find(game_id);
+    if (!found || *found) return nullptr;
+    auto snapshot = sessions_.Load(Games::IndexOf(game_id), game_id, token);
+    if (!snapshot) return nullptr;
+    *found = std::make_unique<Battleship>(*snapshot);
+    return found->get();
+  }
 
-    // Создаём и отправляем начальные позиции новому игроку
+  // ID партии - номер ячейки и поколение, его легко угадать. Секрет берётся
+  // из системного источника случайности, а не из генератора, состояние
+  // которого восстанавливается по его выходу
+  static uint64_t MakeToken() {
+    std::random_device random;
+    return (uint64_t(random()) << 32) | random();
+  }
+
+  static net::SharedMessage<MessageTypes> MakeReclaimResult(
+      uint32_t game_id, const Battleship* game) {
+    GameSnapshot snapshot;
+    if (game) game->Save(snapshot);
     net::Message<MessageTypes> message;
-    message.header.id = MessageTypes::ServerAccept;
-    char buffer[1024];
-    strcpy_s(buffer, game->GetBoard(true).c_str());
-    message << buffer;
-    client->Send(message);
+    message.header.id = MessageTypes::Reclaim;
+    net::MessageWriter(message,
+                       sizeof(game_id) + 2 * sizeof(snapshot.hits))
+        .Write(game_id)
+        .Write(snapshot.hits)
+        .Write(snapshot.misses);
+    return net::MakeSharedMessage(std::move(message));
+  }
+
+  // Ответ на ход: результат выстрела или, при победе, вся доска
+  static net::SharedMessage<MessageTypes> MakeMoveResult(
+      Battleship& game, const char* attack_pos) {
+    Bitboard revealed;
+    Shot shot = game.Attack(std::string(attack_pos, 2), &revealed);
+
+    net::Message<MessageTypes> message;
+
+    if (game.CheckWin()) {
+      // Победа случается раз за партию, тут можно открыть всю доску
+      message.header.id = MessageTypes::Win;
+      std::string_view board = game.GetBoard(false);
+      net::MessageWriter(message, board.size() + 16)
+          .WriteString(board)
+          .WriteString("You win!\n");
+    } else {
+      ShotResult result;
+      result.x = attack_pos[1] - '0';
+      result.y = attack_pos[0] - 'a';
+      result.shot = shot;
+
+      message.header.id = MessageTypes::Battleship;
+      net::MessageWriter writer(message, sizeof(result) + sizeof(revealed));
+      writer.Write(result);
+      if (shot == Shot::sunk) {
+        writer.Write(revealed);
+      }
+    }
+    return net::MakeSharedMessage(std::move(message));
+  }
+
+  // false, если такой партии нет
+  bool Spectate(std::shared_ptr<net::Connection<MessageTypes>> client,
+                uint32_t game_id) {
+    // Саму партию здесь не читаем: её меняет только сессия игрока, так что
+    // зритель получит доску после ближайшего хода. Проверка под
+    // spectators_mutex_ не даст добавить зрителя к партии, которую
+    // FinishGame уже удалил
+    std::scoped_lock lock(spectators_mutex_);
+    {
+      std::shared_lock games_lock(games_mutex_);
+      if (!games_.Contains(game_id)) return false;
+    }
+    spectators_[game_id].push_back(client);
     return true;
   }
 
-  virtual void OnClientDisconnect(
-      std::shared_ptr<net::Connection<MessageTypes>> client) {
-    std::cout << "Removing client [" << client->GetID() << "]\n";
-  }
-
-  // Обработчик сообщений от клиентов
-  virtual void OnMessage(
-      std::shared_ptr<net::Connection<MessageTypes>> client,
-      net::Message<MessageTypes>& user_msg) {
-    switch (user_msg.header.id) {
-
-      case MessageTypes::Battleship: {
-        char attack_pos[3];
-        user_msg >> attack_pos;
-        games_[client->GetID()]->Attack(attack_pos);
-
-        net::Message<MessageTypes> message;
-        char buffer[1024];
-
-        auto game = games_[client->GetID()];
-
-        if (games_[client->GetID()]->CheckWin()) {
-          message.header.id = MessageTypes::Win;
-          std::string win_message(game->GetBoard(false).c_str());
-          win_message += "You win!\n";
-          strcpy_s(buffer, win_message.c_str());   
-        } else {
-          message.header.id = MessageTypes::Battleship;
-          strcpy_s(buffer, game->GetBoard(true).c_str());    
-        }
-        message << buffer;
-        client->Send(message);
-      } break;
+  void StopSpectate(
+      const std::shared_ptr<net::Connection<MessageTypes>>& client,
+      uint32_t game_id) {
+    std::scoped_lock lock(spectators_mutex_);
+    auto it = spectators_.find(game_id);
+    if (it != spectators_.end()) {
+      std::erase(it->second, client);
+      if (it->second.empty()) spectators_.erase(it);
     }
   }
-  vector<Battleship*> games_;
+
+  // Игрок ждёт ответа на каждый ход, так что очередь растёт только у
+  // зрителей. Неуспевающему зрителю достаточно последней доски каждой
+  // партии, а ответы на ходы не заменяются ничем, и при переполнении ими
+  // клиент отключается
+  static net::Connection<MessageTypes>::SendLimits MakeSendLimits() {
+    net::Connection<MessageTypes>::SendLimits limits;
+    limits.high_water_bytes = 256 * 1024;
+    limits.low_water_bytes = 64 * 1024;
+    limits.high_water_messages = 1024;
+    limits.low_water_messages = 256;
+    limits.policy = net::Connection<MessageTypes>::overflow_policy::coalesce;
+    limits.supersedes = [](const net::Message<MessageTypes>& older,
+                           const net::Message<MessageTypes>& newer) {
+      if (older.header.id != MessageTypes::SpectatorUpdate ||
+          newer.header.id != MessageTypes::SpectatorUpdate) {
+        return false;
+      }
+      uint32_t older_game = 0;
+      uint32_t newer_game = 0;
+      net::MessageReader(older).Read(older_game);
+      net::MessageReader(newer).Read(newer_game);
+      return older_game == newer_game;
+    };
+    return limits;
+  }
+
+  // Освобождает партию и список её зрителей. Вызывается только из сессии
+  // игрока
+  void FinishGame(uint32_t game_id) {
+    std::optional<std::unique_ptr<Battleship>> game;
+    {
+      std::unique_lock lock(games_mutex_);
+      game = games_.Extract(game_id);
+      if (game) sessions_.Erase(Games::IndexOf(game_id));
+    }
+    // Пустое место - ID, под которым партия так и не началась
+    if (game && *game) net::Metrics::Add(games_finished_);
+    std::scoped_lock lock(spectators_mutex_);
+    spectators_.erase(game_id);
+  }
+
+  // Ход вида "a3": буква столбца, цифра строки и завершающий ноль - буфер
+  // пришёл из сети, и без нуля дальше он строкой не станет
+  static bool IsCell(const char* attack_pos) {
+    return 'a' <= attack_pos[0] && attack_pos[0] < 'a' + BOARD_SIZE &&
+           '0' <= attack_pos[1] && attack_pos[1] < '0' + BOARD_SIZE &&
+           attack_pos[2] == '\0';
+  }
+
+  net::SharedMessage<MessageTypes> MakeSpectatorUpdate(uint32_t game_id,
+                                                       Battleship& game) {
+    net::Message<MessageTypes> message;
+    message.header.id = MessageTypes::SpectatorUpdate;
+    std::string_view board = game.GetBoard(!game.CheckWin());
+    net::MessageWriter(message, sizeof(game_id) + 4 + board.size())
+        .Write(game_id)
+        .WriteString(board);
+    return net::MakeSharedMessage(std::move(message));
+  }
+
+  // Доска сериализуется один раз, и все зрители получают одно и то же тело
+  void BroadcastToSpectators(uint32_t game_id, Battleship& game) {
+    std::scoped_lock lock(spectators_mutex_);
+    auto it = spectators_.find(game_id);
+    if (it == spectators_.end()) return;
+
+    // Отключившиеся зрители убираются при очередной рассылке
+    std::erase_if(it->second, [](const auto& spectator) {
+      return !spectator->IsConnected();
+    });
+    if (it->second.empty()) {
+      spectators_.erase(it);
+      return;
+    }
+
+    Broadcast(MakeSpectatorUpdate(game_id, game), it->second);
+  }
+
+  BoardPool<Battleship> board_pool_;
+  // Партии по ID, ID партии хранится как сессия соединения игрока. Пустое
+  // место - ID клиента, ещё не сделавшего ход, или восстановленная из файла
+  // партия, за которой пока не пришли
+  using Games = net::SlotMap<std::unique_ptr<Battleship>>;
+  Games games_;
+  std::shared_mutex games_mutex_;
+  // Снимки партий по номеру ячейки в games_
+  SessionFile sessions_;
+  // Восстановленные из файла партии, за которыми игроки ещё не пришли
+  std::vector<uint32_t> unclaimed_;
+
+  // Зрители каждой партии по её ID
+  std::unordered_map<uint32_t,
+                     vector<std::shared_ptr<net::Connection<MessageTypes>>>>
+      spectators_;
+  std::mutex spectators_mutex_;
+
+  // Идущих партий: games_started - games_finished
+  const net::Metrics::counter games_started_ =
+      net::Metrics::AddCounter("games_started");
+  const net::Metrics::counter games_finished_ =
+      net::Metrics::AddCounter("games_finished");
 };
 
 int main() {
-  BattleshipServer server(60000);
+  BattleshipServer server(60000, "sessions.bin");
+  // Сессии разных клиентов идут параллельно во всех потоках ввода-вывода
+  server.SetDispatch(net::IServer<MessageTypes>::dispatch::session);
   server.Start();
+  server.StartMetricsDump(std::chrono::seconds(10));
 
+  // Вся работа идёт в потоках ввода-вывода, главному остаётся ждать. Через
+  // десять минут после запуска невостребованные партии прошлого запуска
+  // освобождаются
+  auto release_at = std::chrono::steady_clock::now() + std::chrono::minutes(10);
   while (1) {
-    server.Update(-1, true);
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (std::chrono::steady_clock::now() >= release_at) {
+      server.ReleaseUnclaimed();
+      release_at = std::chrono::steady_clock::time_point::max();
+    }
   }
 
   return 0;
@@ -0,0 +1,209 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <Log.h>
+
+#include "Battleship.h"
+
+// Снимки идущих партий в файле, отображённом в память. Запись партии с
+// номером ячейки index лежит по фиксированному смещению и переписывается на
+// месте после каждого хода, без сериализации и системных вызовов: страницы
+// на диск сбрасывает ОС, в том числе когда процесс упал. При перезапуске
+// файл отображается снова, и партии читаются прямо из него.
+// Разные партии пишутся в разные записи, так что блокировок тут нет: запись
+// меняет только тот, кто владеет партией
+class SessionFile {
+ public:
+  struct Record {
+    // 0 - запись свободна
+    uint32_t game_id = 0;
+    // Наполовину записанную запись (процесс упал посреди Store) выдаёт
+    // несовпадение суммы
+    uint32_t checksum = 0;
+    // Секрет владельца: ID партии предсказуем, и вернуть её можно только
+    // вместе с ним
+    uint64_t token = 0;
+    GameSnapshot game;
+  };
+
+ public:
+  SessionFile(const std::string& path, size_t capacity)
+      : capacity_(capacity), size_(sizeof(Header) + capacity * sizeof(Record)) {
+    if (!Map(path)) {
+      net::Log::Warning("[Sessions] Can't map {}, sessions are not saved",
+                        path);
+      Unmap();
+      return;
+    }
+    // Файл другого формата или пустой начинаем с чистого листа. Ёмкость
+    // можно менять между запусками: лишние записи отрезаются, новые нулевые
+    Header& header = *reinterpret_cast<Header*>(data_);
+    if (header.magic != MAGIC || header.version != VERSION ||
+        header.record_size != sizeof(Record)) {
+      std::memset(data_, 0, size_);
+      header.magic = MAGIC;
+      header.version = VERSION;
+      header.record_size = sizeof(Record);
+    }
+    header.capacity = static_cast<uint32_t>(capacity_);
+  }
+  SessionFile(const SessionFile&) = delete;
+
+  ~SessionFile() { Unmap(); }
+
+  bool IsOpen() const { return data_ != nullptr; }
+  size_t Capacity() const { return IsOpen() ? capacity_ : 0; }
+
+  // Партии за пределами ёмкости файла не сохраняются
+  void Store(size_t index, uint32_t game_id, uint64_t token,
+             const Battleship& game) {
+    if (index >= Capacity()) return;
+    Record& record = RecordAt(index);
+    GameSnapshot snapshot;
+    game.Save(snapshot);
+    record.game = snapshot;
+    record.token = token;
+    record.checksum = Checksum(game_id, token, snapshot);
+    record.game_id = game_id;
+  }
+
+  void Erase(size_t index) {
+    if (index >= Capacity()) return;
+    RecordAt(index).game_id = 0;
+  }
+
+  // Снимок, если в записи лежит целая и корректная партия game_id с этим
+  // секретом
+  std::optional<GameSnapshot> Load(size_t index, uint32_t game_id,
+                                   uint64_t token) const {
+    if (index >= Capacity()) return std::nullopt;
+    const Record& record = RecordAt(index);
+    if (game_id == 0 || record.game_id != game_id || record.token != token ||
+        !IsIntact(record)) {
+      return std::nullopt;
+    }
+    return record.game;
+  }
+
+  // Вызывает f(index, game_id) для каждой целой записи
+  template <typename F>
+  void ForEach(F f) const {
+    for (size_t index = 0; index < Capacity(); ++index) {
+      const Record& record = RecordAt(index);
+      if (record.game_id != 0 && IsIntact(record)) f(index, record.game_id);
+    }
+  }
+
+ private:
+  static constexpr uint32_t MAGIC = 0x53424553;  // "SEBS"
+  static constexpr uint32_t VERSION = 2;
+
+  // Записи идут после заголовка, выровненного на кэш-линию
+  struct alignas(64) Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+  };
+
+  Record& RecordAt(size_t index) {
+    return reinterpret_cast<Record*>(data_ + sizeof(Header))[index];
+  }
+  const Record& RecordAt(size_t index) const {
+    return reinterpret_cast<const Record*>(data_ + sizeof(Header))[index];
+  }
+
+  static bool IsIntact(const Record& record) {
+    return record.checksum ==
+               Checksum(record.game_id, record.token, record.game) &&
+           record.game.IsValid();
+  }
+
+  // FNV-1a по ID, секрету и снимку
+  static uint32_t Checksum(uint32_t game_id, uint64_t token,
+                           const GameSnapshot& snapshot) {
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const void* data, size_t size) {
+      auto bytes = static_cast<const uint8_t*>(data);
+      for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+      }
+    };
+    mix(&game_id, sizeof(game_id));
+    mix(&token, sizeof(token));
+    mix(&snapshot, sizeof(snapshot));
+    return hash;
+  }
+
+#ifdef _WIN32
+  bool Map(const std::string& path) {
+    file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                        FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_ == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    size.QuadPart = static_cast<LONGLONG>(size_);
+    if (!SetFilePointerEx(file_, size, nullptr, FILE_BEGIN) ||
+        !SetEndOfFile(file_)) {
+      return false;
+    }
+    mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READWRITE, 0, 0,
+                                  nullptr);
+    if (!mapping_) return false;
+    data_ = static_cast<uint8_t*>(
+        MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size_));
+    return data_ != nullptr;
+  }
+
+  void Unmap() {
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    data_ = nullptr;
+    mapping_ = nullptr;
+    file_ = INVALID_HANDLE_VALUE;
+  }
+
+  HANDLE file_ = INVALID_HANDLE_VALUE;
+  HANDLE mapping_ = nullptr;
+#else
+  bool Map(const std::string& path) {
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0 || ::ftruncate(fd_, static_cast<off_t>(size_)) != 0) {
+      return false;
+    }
+    void* data =
+        ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) return false;
+    data_ = static_cast<uint8_t*>(data);
+    return true;
+  }
+
+  void Unmap() {
+    if (data_) ::munmap(data_, size_);
+    if (fd_ >= 0) ::close(fd_);
+    data_ = nullptr;
+    fd_ = -1;
+  }
+
+  int fd_ = -1;
+#endif
+
+  size_t capacity_;
+  size_t size_;
+  uint8_t* data_ = nullptr;
+};
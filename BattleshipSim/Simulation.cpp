@@ -0,0 +1,340 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BitBattleship.h"
+#include "Battleship.h"
+#include "Solver.h"
+
+// Прогон множества полных партий движка Battleship без сети: стрелок по
+// плотности вероятности играет каждую партию до победы. Партии разбиты на
+// пачки, которые потоки берут из своих очередей, а опустевший поток
+// забирает пачки у соседей. Каждая партия сверяется с BitBattleship, так
+// что прогон заодно ловит ошибки движка
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  uint64_t games = 1000000;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t batch = 256;
+};
+
+// Итоги одного потока, в конце складываются
+struct alignas(64) WorkerStats {
+  uint64_t games = 0;
+  uint64_t shots = 0;
+  uint32_t min_shots = BOARD_SIZE * BOARD_SIZE;
+  uint32_t max_shots = 0;
+  uint64_t shots_histogram[BOARD_SIZE * BOARD_SIZE + 1] = {};
+  // Время движка: создание партии с RandomArrangement и повтор всех ходов
+  // партии на свежей доске
+  std::chrono::nanoseconds arrange_time{0};
+  std::chrono::nanoseconds attack_time{0};
+  uint64_t attacks = 0;
+  // Как часто клетка занята кораблём
+  uint64_t occupancy[BOARD_SIZE * BOARD_SIZE] = {};
+  // Горизонтальные и вертикальные корабли длины 2..THE_BIGGEST_SHIP
+  uint64_t horizontal[THE_BIGGEST_SHIP] = {};
+  uint64_t vertical[THE_BIGGEST_SHIP] = {};
+  // Расхождения с BitBattleship
+  uint64_t mismatches = 0;
+  // Steals - сколько пачек поток забрал у других
+  uint64_t steals = 0;
+
+  void Merge(const WorkerStats& other) {
+    games += other.games;
+    shots += other.shots;
+    min_shots = std::min(min_shots, other.min_shots);
+    max_shots = std::max(max_shots, other.max_shots);
+    for (int i = 0; i <= BOARD_SIZE * BOARD_SIZE; ++i) {
+      shots_histogram[i] += other.shots_histogram[i];
+    }
+    arrange_time += other.arrange_time;
+    attack_time += other.attack_time;
+    attacks += other.attacks;
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i) {
+      occupancy[i] += other.occupancy[i];
+    }
+    for (int i = 0; i < THE_BIGGEST_SHIP; ++i) {
+      horizontal[i] += other.horizontal[i];
+      vertical[i] += other.vertical[i];
+    }
+    mismatches += other.mismatches;
+    steals += other.steals;
+  }
+};
+
+// Пачка партий [begin, end)
+struct Batch {
+  uint64_t begin = 0;
+  uint64_t end = 0;
+};
+
+// Очереди пачек с кражей работы. Хозяин берёт пачки с конца своей
+// очереди, а вор - с начала чужой, так что они редко сталкиваются.
+// Пачки крупные, поэтому мьютекса на очередь достаточно
+class WorkStealingQueues {
+ public:
+  WorkStealingQueues(size_t workers, uint64_t games, uint64_t batch)
+      : queues_(workers) {
+    size_t worker = 0;
+    for (uint64_t begin = 0; begin < games; begin += batch) {
+      uint64_t end = std::min(games, begin + batch);
+      queues_[worker].batches.push_back({begin, end});
+      worker = (worker + 1) % workers;
+    }
+  }
+
+  // false, когда работы не осталось ни у кого
+  bool Pop(size_t worker, Batch& batch, uint64_t& steals) {
+    {
+      auto& own = queues_[worker];
+      std::scoped_lock lock(own.mutex);
+      if (!own.batches.empty()) {
+        batch = own.batches.back();
+        own.batches.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues_.size(); ++i) {
+      auto& victim = queues_[(worker + i) % queues_.size()];
+      std::scoped_lock lock(victim.mutex);
+      if (!victim.batches.empty()) {
+        batch = victim.batches.front();
+        victim.batches.pop_front();
+        ++steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct alignas(64) Queue {
+    std::mutex mutex;
+    std::deque<Batch> batches;
+  };
+  std::vector<Queue> queues_;
+};
+
+// Названия клеток для Attack: "a0" ... "j9"
+static const std::vector<std::string>& CellNames() {
+  static const std::vector<std::string> names = []() {
+    std::vector<std::string> names;
+    for (int index = 0; index < BOARD_SIZE * BOARD_SIZE; ++index) {
+      names.push_back({static_cast<char>('a' + index % BOARD_SIZE),
+                       static_cast<char>('0' + index / BOARD_SIZE)});
+    }
+    return names;
+  }();
+  return names;
+}
+
+static Fleet FleetOf(const Battleship& game) {
+  Fleet fleet;
+  for (int x = 0; x < BOARD_SIZE; ++x) {
+    for (int y = 0; y < BOARD_SIZE; ++y) {
+      int id = game.GetShipId(x, y);
+      if (id >= 0) fleet.ships[id] |= Bitboard::Cell(x * BOARD_SIZE + y);
+    }
+  }
+  return fleet;
+}
+
+static void CountPlacement(const Fleet& fleet, WorkerStats& stats) {
+  for (const Bitboard& ship : fleet.ships) {
+    int first = -1;
+    bool horizontal = true;
+    ship.ForEach([&](int index) {
+      ++stats.occupancy[index];
+      if (first < 0) {
+        first = index;
+      } else if (index / BOARD_SIZE != first / BOARD_SIZE) {
+        horizontal = false;
+      }
+    });
+    int length = ship.Count();
+    if (length < 2) continue;
+    ++(horizontal ? stats.horizontal : stats.vertical)[length - 1];
+  }
+}
+
+// Одна партия от расстановки до победы
+static void PlayGame(WorkerStats& stats) {
+  const auto& names = CellNames();
+
+  auto arrange_start = Clock::now();
+  Battleship game;
+  stats.arrange_time += Clock::now() - arrange_start;
+
+  Fleet fleet = FleetOf(game);
+  CountPlacement(fleet, stats);
+
+  BitBattleship mirror(fleet);
+  DensitySolver solver;
+  int shots[BOARD_SIZE * BOARD_SIZE];
+  uint32_t shots_count = 0;
+  bool mismatch = false;
+  while (!game.CheckWin() && shots_count < BOARD_SIZE * BOARD_SIZE) {
+    int index = solver.NextShot();
+    if (index < 0) break;
+    shots[shots_count++] = index;
+
+    Bitboard revealed;
+    Shot result = game.Attack(names[index], &revealed);
+
+    Bitboard misses_before = mirror.GetMisses();
+    Shot expected = mirror.Attack(index / BOARD_SIZE, index % BOARD_SIZE);
+    // Промахи движка-образца без самой клетки выстрела - это и есть
+    // открытые вокруг потопленного корабля клетки
+    Bitboard expected_revealed =
+        mirror.GetMisses() & ~misses_before & ~Bitboard::Cell(index);
+    if (result != expected || !(revealed == expected_revealed)) {
+      mismatch = true;
+    }
+
+    solver.OnResult(index, result, revealed);
+  }
+  if (!game.CheckWin() || !mirror.CheckWin()) mismatch = true;
+
+  // Повтор тех же ходов на свежей доске: время чистого Attack без
+  // стрелка и сверки
+  Battleship replay(fleet);
+  auto attack_start = Clock::now();
+  for (uint32_t i = 0; i < shots_count; ++i) {
+    replay.Attack(names[shots[i]]);
+  }
+  stats.attack_time += Clock::now() - attack_start;
+  stats.attacks += shots_count;
+  if (!replay.CheckWin()) mismatch = true;
+
+  ++stats.games;
+  stats.shots += shots_count;
+  stats.min_shots = std::min(stats.min_shots, shots_count);
+  stats.max_shots = std::max(stats.max_shots, shots_count);
+  ++stats.shots_histogram[shots_count];
+  if (mismatch) ++stats.mismatches;
+}
+
+static uint32_t ShotsPercentile(const WorkerStats& stats, double percent) {
+  uint64_t rank = static_cast<uint64_t>(percent / 100.0 * (stats.games - 1));
+  uint64_t seen = 0;
+  for (int i = 0; i <= BOARD_SIZE * BOARD_SIZE; ++i) {
+    seen += stats.shots_histogram[i];
+    if (seen > rank) return i;
+  }
+  return BOARD_SIZE * BOARD_SIZE;
+}
+
+static void Report(const WorkerStats& total, double seconds,
+                   const Options& options) {
+  double games = static_cast<double>(total.games);
+  std::printf("[Sim] %llu games in %.2f s on %zu threads: %.0f games/s, "
+              "%llu batches stolen\n",
+              (unsigned long long)total.games, seconds, options.threads,
+              games / seconds, (unsigned long long)total.steals);
+  std::printf("[Sim] shots per game: mean %.2f, min %u, p50 %u, p99 %u, "
+              "max %u\n",
+              total.shots / games, total.min_shots, ShotsPercentile(total, 50),
+              ShotsPercentile(total, 99), total.max_shots);
+  std::printf("[Sim] engine: RandomArrangement + setup %.0f ns/game, "
+              "Attack %.1f ns/shot\n",
+              total.arrange_time.count() / games,
+              double(total.attack_time.count()) / total.attacks);
+
+  std::printf("[Sim] ship occupancy per cell, %% of games:\n   ");
+  for (int y = 0; y < BOARD_SIZE; ++y) std::printf("     %c", 'a' + y);
+  std::printf("\n");
+  double min_occupancy = 100;
+  double max_occupancy = 0;
+  for (int x = 0; x < BOARD_SIZE; ++x) {
+    std::printf("   %d", x);
+    for (int y = 0; y < BOARD_SIZE; ++y) {
+      double percent = 100.0 * total.occupancy[x * BOARD_SIZE + y] / games;
+      min_occupancy = std::min(min_occupancy, percent);
+      max_occupancy = std::max(max_occupancy, percent);
+      std::printf(" %5.1f", percent);
+    }
+    std::printf("\n");
+  }
+  std::printf("[Sim] occupancy min %.1f%%, max %.1f%%\n", min_occupancy,
+              max_occupancy);
+  for (int length = 2; length <= THE_BIGGEST_SHIP; ++length) {
+    uint64_t horizontal = total.horizontal[length - 1];
+    uint64_t vertical = total.vertical[length - 1];
+    uint64_t placed = std::max<uint64_t>(1, horizontal + vertical);
+    std::printf("[Sim] %d-deck ships horizontal %.2f%%\n", length,
+                100.0 * horizontal / placed);
+  }
+  std::printf("[Sim] engine mismatches: %llu\n",
+              (unsigned long long)total.mismatches);
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value =
+        equals == std::string::npos ? "" : arg.substr(equals + 1);
+    try {
+      if (key == "--games") {
+        options.games = std::stoull(value);
+      } else if (key == "--threads") {
+        options.threads = std::max<size_t>(1, std::stoul(value));
+      } else if (key == "--batch") {
+        options.batch = std::max<uint64_t>(1, std::stoull(value));
+      } else {
+        return false;
+      }
+    } catch (std::exception&) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, options) || options.games == 0) {
+    std::cout << "Usage: Sim [--games=1000000] [--threads=N] "
+                 "[--batch=256]\n";
+    return 1;
+  }
+
+  WorkStealingQueues queues(options.threads, options.games, options.batch);
+  std::vector<WorkerStats> stats(options.threads);
+
+  auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (size_t worker = 0; worker < options.threads; ++worker) {
+    threads.emplace_back([&, worker]() {
+      WorkerStats& own = stats[worker];
+      Batch batch;
+      while (queues.Pop(worker, batch, own.steals)) {
+        for (uint64_t game = batch.begin; game < batch.end; ++game) {
+          PlayGame(own);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  WorkerStats total;
+  for (auto& worker : stats) total.Merge(worker);
+  Report(total, seconds, options);
+
+  // Ненулевой код, чтобы прогон можно было использовать как проверку
+  return total.mismatches == 0 ? 0 : 2;
+}
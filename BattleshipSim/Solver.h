@@ -0,0 +1,115 @@
+﻿#pragma once
+#include <cstdint>
+
+#include "Battleship.h"
+#include "Bitboard.h"
+#include "FleetGenerator.h"
+
+// Стрелок по плотности вероятности. Для каждой ещё не открытой клетки
+// считается, сколько допустимых положений оставшихся кораблей её накрывают,
+// и выбирается клетка с наибольшим числом. Пока есть раненый корабль,
+// учитываются только положения, проходящие через раненые клетки
+class DensitySolver {
+ public:
+  DensitySolver() {
+    for (int ship_type = 0; ship_type < THE_BIGGEST_SHIP; ++ship_type) {
+      remaining_[ship_type] = THE_BIGGEST_SHIP - ship_type;
+    }
+  }
+
+  // Номер клетки x * BOARD_SIZE + y или -1, если стрелять некуда
+  int NextShot() const {
+    Bitboard shot = misses_ | wounded_ | sunk_;
+    Bitboard blocked = misses_ | sunk_;
+    bool target = wounded_.Any();
+
+    uint32_t density[BOARD_SIZE * BOARD_SIZE] = {};
+    for (int ship_type = 0; ship_type < THE_BIGGEST_SHIP; ++ship_type) {
+      if (remaining_[ship_type] == 0) continue;
+
+      const ShipPlacement* placements = PLACEMENTS.placements[ship_type];
+      int count = PLACEMENTS.count[ship_type];
+      for (int i = 0; i < count; ++i) {
+        const ShipPlacement& placement = placements[i];
+        if ((placement.ship & blocked).Any()) continue;
+
+        uint32_t weight = remaining_[ship_type];
+        if (target) {
+          int covered = (placement.ship & wounded_).Count();
+          if (covered == 0) continue;
+          // Корабли не касаются друг друга, поэтому раненая клетка рядом с
+          // положением должна в него входить
+          if ((placement.zone & ~placement.ship & wounded_).Any()) continue;
+          weight <<= 4 * covered;
+        }
+        (placement.ship & ~shot).ForEach(
+            [&](int index) { density[index] += weight; });
+      }
+    }
+
+    int best = -1;
+    uint32_t best_density = 0;
+    for (int index = 0; index < BOARD_SIZE * BOARD_SIZE; ++index) {
+      if (!shot.Test(index) && (best < 0 || density[index] > best_density)) {
+        best = index;
+        best_density = density[index];
+      }
+    }
+    return best;
+  }
+
+  // revealed - клетки вокруг потопленного корабля, открытые сервером
+  void OnResult(int index, Shot result, const Bitboard& revealed) {
+    Bitboard cell = Bitboard::Cell(index);
+    switch (result) {
+      case Shot::miss:
+        misses_ |= cell;
+        break;
+
+      case Shot::hit:
+        wounded_ |= cell;
+        break;
+
+      case Shot::sunk: {
+        wounded_ |= cell;
+        Bitboard ship = ShipOf(index);
+        --remaining_[ship.Count() - 1];
+        wounded_ = wounded_ & ~ship;
+        sunk_ |= ship;
+        misses_ |= revealed;
+      } break;
+
+      case Shot::repeat:
+        break;
+    }
+  }
+
+ private:
+  // Раненые клетки, связанные с index по сторонам: это один корабль, ведь
+  // разные корабли не соприкасаются
+  Bitboard ShipOf(int index) const {
+    Bitboard ship = Bitboard::Cell(index);
+    while (true) {
+      Bitboard grown = ship;
+      ship.ForEach([&](int i) {
+        int x = i / BOARD_SIZE;
+        int y = i % BOARD_SIZE;
+        if (x > 0) grown |= Bitboard::Cell(i - BOARD_SIZE);
+        if (x + 1 < BOARD_SIZE) grown |= Bitboard::Cell(i + BOARD_SIZE);
+        if (y > 0) grown |= Bitboard::Cell(i - 1);
+        if (y + 1 < BOARD_SIZE) grown |= Bitboard::Cell(i + 1);
+      });
+      grown = grown & wounded_;
+      if (grown == ship) return ship;
+      ship = grown;
+    }
+  }
+
+  // Промахи вместе с клетками, открытыми вокруг потопленных кораблей
+  Bitboard misses_;
+  // Попадания в ещё не потопленные корабли
+  Bitboard wounded_;
+  Bitboard sunk_;
+  // Сколько кораблей каждой длины ещё не потоплено
+  int remaining_[THE_BIGGEST_SHIP];
+};
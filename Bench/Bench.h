@@ -0,0 +1,267 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Версия, компилятор и тип сборки передаёт CMake
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+#ifndef BENCH_COMPILER
+#define BENCH_COMPILER "unknown"
+#endif
+#ifndef BENCH_BUILD_TYPE
+#define BENCH_BUILD_TYPE "unknown"
+#endif
+
+// Минимальный каркас микробенчмарков. Каждый бенчмарк - функция, которая
+// выполняет run.iterations операций. Число итераций подбирается так, чтобы
+// один замер шёл не меньше --min-time, затем замер повторяется
+// --repetitions раз. Результат печатается по строке JSON на бенчмарк
+// (JSON Lines), чтобы его можно было складывать в историю и сравнивать
+// между версиями. Первая строка описывает сборку и машину
+namespace bench {
+using Clock = std::chrono::steady_clock;
+
+// Не даёт компилятору выбросить вычисление, результат которого не нужен
+template <typename DataType>
+inline void DoNotOptimize(const DataType& value) {
+#if defined(__GNUC__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static const void* volatile sink;
+  sink = &value;
+#endif
+}
+
+class Run {
+ public:
+  explicit Run(uint64_t iterations) : iterations(iterations) {}
+
+  // Сколько элементов или байт обработано за все итерации замера, для
+  // пересчёта в items_per_second и bytes_per_second
+  void SetItems(uint64_t items) { items_ = items; }
+  void SetBytes(uint64_t bytes) { bytes_ = bytes; }
+
+  // Произвольная величина, например перцентиль задержки. Попадает в
+  // результат из последнего повтора
+  void Counter(const std::string& name, double value) {
+    counters_[name] = value;
+  }
+
+  // Подготовку внутри бенчмарка можно исключить из замера
+  void PauseTiming() { paused_at_ = Clock::now(); }
+  void ResumeTiming() { paused_ += Clock::now() - paused_at_; }
+
+  uint64_t iterations;
+
+ private:
+  friend class Registry;
+
+  uint64_t items_ = 0;
+  uint64_t bytes_ = 0;
+  std::map<std::string, double> counters_;
+  Clock::time_point paused_at_;
+  Clock::duration paused_{0};
+};
+
+struct Options {
+  std::string filter;
+  double min_time = 0.2;
+  int repetitions = 5;
+  // Дописывать результаты в файл вместо stdout
+  std::string out;
+  // Только вывести имена бенчмарков
+  bool list = false;
+};
+
+class Registry {
+ public:
+  using Function = std::function<void(Run&)>;
+
+  static Registry& Instance() {
+    static Registry registry;
+    return registry;
+  }
+
+  // fixed_iterations > 0 отключает подбор: так удобнее для бенчмарков, где
+  // одна итерация - целый сетевой сценарий
+  void Add(std::string name, Function function, uint64_t fixed_iterations) {
+    benchmarks_.push_back({std::move(name), std::move(function),
+                           fixed_iterations});
+  }
+
+  int Main(const char* suite, int argc, char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+      std::fprintf(stderr,
+                   "Usage: %s [--filter=substring] [--min-time=0.2] "
+                   "[--repetitions=5] [--out=results.jsonl] [--list]\n",
+                   argv[0]);
+      return 1;
+    }
+    if (options.list) {
+      for (auto& benchmark : benchmarks_) {
+        std::printf("%s\n", benchmark.name.c_str());
+      }
+      return 0;
+    }
+
+    std::FILE* out = stdout;
+    if (!options.out.empty()) {
+      out = std::fopen(options.out.c_str(), "a");
+      if (out == nullptr) {
+        std::perror(options.out.c_str());
+        return 1;
+      }
+    }
+
+    PrintContext(out, suite, options);
+    for (auto& benchmark : benchmarks_) {
+      if (benchmark.name.find(options.filter) == std::string::npos) continue;
+      Measure(out, suite, benchmark, options);
+      std::fflush(out);
+    }
+
+    if (out != stdout) std::fclose(out);
+    return 0;
+  }
+
+ private:
+  struct Benchmark {
+    std::string name;
+    Function function;
+    uint64_t fixed_iterations = 0;
+  };
+
+  struct Sample {
+    double seconds = 0;
+    Run run{0};
+  };
+
+  static Sample Once(const Benchmark& benchmark, uint64_t iterations) {
+    Sample sample{0, Run(iterations)};
+    auto start = Clock::now();
+    benchmark.function(sample.run);
+    auto elapsed = Clock::now() - start - sample.run.paused_;
+    sample.seconds = std::chrono::duration<double>(elapsed).count();
+    return sample;
+  }
+
+  static void Measure(std::FILE* out, const char* suite,
+                      const Benchmark& benchmark, const Options& options) {
+    // Подбор: увеличиваем число итераций, пока замер не станет достаточно
+    // длинным, заодно прогревая кэши и аллокаторы
+    uint64_t iterations = benchmark.fixed_iterations;
+    if (iterations == 0) {
+      iterations = 1;
+      while (true) {
+        Sample sample = Once(benchmark, iterations);
+        if (sample.seconds >= options.min_time || iterations >= 1ull << 40) {
+          break;
+        }
+        double scale = sample.seconds > 0
+                           ? options.min_time * 1.4 / sample.seconds
+                           : 100.0;
+        iterations = static_cast<uint64_t>(
+            iterations * std::clamp(scale, 2.0, 100.0));
+      }
+    }
+
+    std::vector<double> ns_per_op;
+    Sample last;
+    for (int i = 0; i < options.repetitions; ++i) {
+      last = Once(benchmark, iterations);
+      ns_per_op.push_back(last.seconds * 1e9 / iterations);
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    double median = ns_per_op[ns_per_op.size() / 2];
+    double seconds_per_run = median * 1e-9 * iterations;
+
+    std::fprintf(out,
+                 "{\"suite\":\"%s\",\"name\":\"%s\",\"iterations\":%llu,"
+                 "\"repetitions\":%d,\"ns_per_op\":%.3f,"
+                 "\"ns_per_op_min\":%.3f,\"ns_per_op_max\":%.3f",
+                 suite, benchmark.name.c_str(),
+                 static_cast<unsigned long long>(iterations),
+                 options.repetitions, median, ns_per_op.front(),
+                 ns_per_op.back());
+    if (last.run.items_ > 0) {
+      std::fprintf(out, ",\"items_per_second\":%.1f",
+                   last.run.items_ / seconds_per_run);
+    }
+    if (last.run.bytes_ > 0) {
+      std::fprintf(out, ",\"bytes_per_second\":%.1f",
+                   last.run.bytes_ / seconds_per_run);
+    }
+    for (auto& [name, value] : last.run.counters_) {
+      std::fprintf(out, ",\"%s\":%.3f", name.c_str(), value);
+    }
+    std::fprintf(out, "}\n");
+  }
+
+  static void PrintContext(std::FILE* out, const char* suite,
+                           const Options& options) {
+    char date[32] = {};
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ",
+                  std::gmtime(&now));
+    std::fprintf(out,
+                 "{\"suite\":\"%s\",\"context\":{\"date\":\"%s\","
+                 "\"version\":\"%s\",\"compiler\":\"%s\","
+                 "\"build_type\":\"%s\",\"hardware_threads\":%u,"
+                 "\"min_time\":%.3f}}\n",
+                 suite, date, BENCH_VERSION, BENCH_COMPILER, BENCH_BUILD_TYPE,
+                 std::thread::hardware_concurrency(), options.min_time);
+  }
+
+  static bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto equals = arg.find('=');
+      std::string key = arg.substr(0, equals);
+      std::string value =
+          equals == std::string::npos ? "" : arg.substr(equals + 1);
+      try {
+        if (key == "--filter") {
+          options.filter = value;
+        } else if (key == "--min-time") {
+          options.min_time = std::stod(value);
+        } else if (key == "--repetitions") {
+          options.repetitions = std::max(1, std::stoi(value));
+        } else if (key == "--out") {
+          options.out = value;
+        } else if (key == "--list") {
+          options.list = true;
+        } else {
+          return false;
+        }
+      } catch (std::exception&) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<Benchmark> benchmarks_;
+};
+
+// Регистрация бенчмарка при статической инициализации
+struct Register {
+  Register(std::string name, Registry::Function function,
+           uint64_t fixed_iterations = 0) {
+    Registry::Instance().Add(std::move(name), std::move(function),
+                             fixed_iterations);
+  }
+};
+}
@@ -0,0 +1,316 @@
+﻿#include <Net.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+
+// Полный путь сообщения через loopback TCP: IClient -> Connection ->
+// IServer -> OnMessage -> Send обратно -> IClient. Сервер и клиенты живут
+// весь прогон, чтобы в замер не попадало подключение. Тот же путь
+// меряется через Unix domain socket и через поток в памяти процесса
+// (transport::Loopback), где нет ни ядра, ни сетевого стека
+
+namespace {
+enum class MessageTypes : uint32_t { Echo };
+
+using Message = net::Message<MessageTypes>;
+
+// Порт 0: система выдаёт свободный, прогоны не мешают друг другу
+const asio::ip::tcp::endpoint tcp_endpoint(asio::ip::address_v4::loopback(),
+                                           0);
+
+template <typename Transport = net::transport::Tcp>
+class EchoServer : public net::IServer<MessageTypes, Transport> {
+ public:
+  using Base = net::IServer<MessageTypes, Transport>;
+
+  explicit EchoServer(
+      const typename Transport::Endpoint& endpoint = tcp_endpoint)
+      : Base(endpoint, 1) {
+    this->Start(1);
+  }
+  ~EchoServer() { this->Stop(); }
+
+  // Адрес, к которому подключаются клиенты
+  typename Transport::Endpoint Address() const {
+    return this->acceptor_.local_endpoint();
+  }
+
+ protected:
+  bool OnClientConnect(
+      std::shared_ptr<typename Base::ClientConnection>) override {
+    return true;
+  }
+
+  void OnMessage(std::shared_ptr<typename Base::ClientConnection> client,
+                 Message& message) override {
+    client->Send(message);
+  }
+};
+
+// То же эхо корутиной сессии: сообщение не проходит через очередь сервера
+class EchoSessionServer : public net::IServer<MessageTypes> {
+ public:
+  EchoSessionServer() : net::IServer<MessageTypes>(tcp_endpoint, 1) {
+    SetDispatch(dispatch::session);
+    Start();
+  }
+  ~EchoSessionServer() { Stop(); }
+
+  asio::ip::tcp::endpoint Address() const {
+    return acceptor_.local_endpoint();
+  }
+
+ protected:
+  bool OnClientConnect(
+      std::shared_ptr<net::Connection<MessageTypes>>) override {
+    return true;
+  }
+
+  Session OnClientSession(
+      std::shared_ptr<net::Connection<MessageTypes>> client) override {
+    while (auto message = co_await client->Receive()) {
+      co_await client->AsyncSend(net::MakeSharedMessage(std::move(*message)));
+    }
+  }
+};
+
+// Подключение асинхронное: шлём пробные сообщения, пока не придёт эхо
+template <typename Transport = net::transport::Tcp>
+class QueueClient : public net::IClient<MessageTypes, Transport> {
+ public:
+  explicit QueueClient(const typename Transport::Endpoint& endpoint) {
+    this->Connect(endpoint);
+    Message ping;
+    ping.header.id = MessageTypes::Echo;
+    do {
+      this->Send(ping);
+    } while (!this->Incoming().WaitFor(std::chrono::milliseconds(10)));
+    this->Incoming().Clear();
+  }
+};
+
+class CallbackClient : public net::IClient<MessageTypes> {
+ public:
+  explicit CallbackClient(const asio::ip::tcp::endpoint& endpoint) {
+    SetDispatch(dispatch::callback);
+    Connect(endpoint);
+    Message ping;
+    ping.header.id = MessageTypes::Echo;
+    do {
+      Send(ping);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    } while (received.load() == 0);
+  }
+  ~CallbackClient() { Disconnect(); }
+
+  std::atomic<uint64_t> received = 0;
+
+ protected:
+  void OnMessage(Message&) override {
+    received.fetch_add(1, std::memory_order_release);
+    received.notify_one();
+  }
+};
+
+// Создаётся в main, а не статической переменной: серверы и клиенты
+// останавливаются до выхода из main, пока живы пулы памяти и журнал
+struct Fixture {
+  EchoServer<> server;
+  QueueClient<> queue_client{server.Address()};
+  CallbackClient callback_client{server.Address()};
+  EchoSessionServer session_server;
+  QueueClient<> session_client{session_server.Address()};
+  EchoServer<net::transport::Loopback> loopback_server{{"EchoBench"}};
+  QueueClient<net::transport::Loopback> loopback_client{
+      loopback_server.Address()};
+#ifdef NET_HAS_LOCAL_SOCKETS
+  EchoServer<net::transport::Local> local_server{LocalPath()};
+  QueueClient<net::transport::Local> local_client{local_server.Address()};
+
+  ~Fixture() {
+    std::error_code ec;
+    std::filesystem::remove(local_server.Address().path(), ec);
+  }
+
+  // Свой файл сокета на прогон, чтобы параллельные прогоны не мешали
+  // друг другу
+  static asio::local::stream_protocol::endpoint LocalPath() {
+    auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    return (std::filesystem::temp_directory_path() /
+            ("EchoBench." + std::to_string(stamp) + ".sock"))
+        .string();
+  }
+#endif
+};
+
+Fixture* fixture = nullptr;
+
+Message MakeMessage(size_t bytes) {
+  Message message;
+  message.header.id = MessageTypes::Echo;
+  message.body.resize(bytes);
+  message.header.size = static_cast<uint32_t>(bytes);
+  return message;
+}
+
+// Память обработчиков ASIO, которой не хватило в HandlerMemory соединений
+// (на обеих сторонах), в среднем за итерацию. В установившемся режиме 0
+class HandlerHeapCounter {
+ public:
+  HandlerHeapCounter() : start_(Count()) {}
+
+  void Report(bench::Run& run) const {
+    run.Counter("handler_heap_per_op",
+                static_cast<double>(Count() - start_) / run.iterations);
+  }
+
+ private:
+  static uint64_t Count() {
+    return net::Metrics::GetSnapshot().Get(
+        net::Metrics::counter::handler_heap_allocations);
+  }
+
+  uint64_t start_;
+};
+
+// Перцентили задержки в микросекундах
+void LatencyCounters(bench::Run& run, std::vector<double>& latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&](double percent) {
+    return latencies[static_cast<size_t>(percent / 100.0 *
+                                         (latencies.size() - 1))];
+  };
+  run.Counter("p50_us", at(50));
+  run.Counter("p99_us", at(99));
+  run.Counter("p999_us", at(99.9));
+}
+
+// Пинг-понг: следующее сообщение уходит только после эха предыдущего
+template <typename Client>
+void Roundtrip(bench::Run& run, Client& client) {
+  Message message = MakeMessage(sizeof(uint64_t));
+  std::vector<double> latencies;
+  latencies.reserve(run.iterations);
+  HandlerHeapCounter heap;
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    auto start = bench::Clock::now();
+    client.Send(message);
+    client.Incoming().Wait();
+    client.Incoming().PopFront();
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            bench::Clock::now() - start)
+                            .count());
+  }
+  LatencyCounters(run, latencies);
+  heap.Report(run);
+  run.SetItems(run.iterations);
+}
+
+void RoundtripQueue(bench::Run& run) {
+  Roundtrip(run, fixture->queue_client);
+}
+
+// Сервер отвечает из корутины сессии
+void RoundtripSession(bench::Run& run) {
+  Roundtrip(run, fixture->session_client);
+}
+
+void RoundtripLoopback(bench::Run& run) {
+  Roundtrip(run, fixture->loopback_client);
+}
+
+#ifdef NET_HAS_LOCAL_SOCKETS
+void RoundtripLocal(bench::Run& run) {
+  Roundtrip(run, fixture->local_client);
+}
+#endif
+
+// То же без очереди: эхо разбирается прямо в потоке ASIO context
+void RoundtripCallback(bench::Run& run) {
+  CallbackClient& client = fixture->callback_client;
+  Message message = MakeMessage(sizeof(uint64_t));
+  std::vector<double> latencies;
+  latencies.reserve(run.iterations);
+  HandlerHeapCounter heap;
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    uint64_t received = client.received.load(std::memory_order_acquire);
+    auto start = bench::Clock::now();
+    client.Send(message);
+    client.received.wait(received, std::memory_order_acquire);
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            bench::Clock::now() - start)
+                            .count());
+  }
+  LatencyCounters(run, latencies);
+  heap.Report(run);
+  run.SetItems(run.iterations);
+}
+
+// В полёте держится window сообщений: пропускная способность, а не
+// задержка
+template <size_t window, size_t bytes, typename Client>
+void Pipelined(bench::Run& run, Client& client) {
+  Message message = MakeMessage(bytes);
+  std::vector<std::decay_t<decltype(client.Incoming().PopFront())>> batch;
+  uint64_t sent = 0;
+  uint64_t received = 0;
+  HandlerHeapCounter heap;
+  for (; sent < std::min<uint64_t>(window, run.iterations); ++sent) {
+    client.Send(message);
+  }
+  while (received < run.iterations) {
+    client.Incoming().Wait();
+    size_t count = client.Incoming().DrainInto(batch);
+    batch.clear();
+    received += count;
+    for (size_t i = 0; i < count && sent < run.iterations; ++i, ++sent) {
+      client.Send(message);
+    }
+  }
+  heap.Report(run);
+  run.SetItems(run.iterations);
+  run.SetBytes(run.iterations * bytes);
+}
+
+// Одна итерация - одно сообщение туда и обратно
+bench::Register roundtrip_queue("echo/roundtrip_queue", RoundtripQueue);
+bench::Register roundtrip_callback("echo/roundtrip_callback",
+                                   RoundtripCallback);
+bench::Register roundtrip_session("echo/roundtrip_session",
+                                  RoundtripSession);
+bench::Register roundtrip_loopback("echo/roundtrip_loopback",
+                                   RoundtripLoopback);
+#ifdef NET_HAS_LOCAL_SOCKETS
+bench::Register roundtrip_local("echo/roundtrip_local", RoundtripLocal);
+#endif
+bench::Register pipelined_small("echo/pipelined_64x8b", [](bench::Run& run) {
+  Pipelined<64, 8>(run, fixture->queue_client);
+});
+bench::Register pipelined_large("echo/pipelined_16x4k", [](bench::Run& run) {
+  Pipelined<16, 4096>(run, fixture->queue_client);
+});
+bench::Register pipelined_small_loopback(
+    "echo/pipelined_64x8b_loopback", [](bench::Run& run) {
+      Pipelined<64, 8>(run, fixture->loopback_client);
+    });
+bench::Register pipelined_large_loopback(
+    "echo/pipelined_16x4k_loopback", [](bench::Run& run) {
+      Pipelined<16, 4096>(run, fixture->loopback_client);
+    });
+}
+
+int main(int argc, char* argv[]) {
+  // Сетевая библиотека пишет о подключениях в лог, а stdout занят
+  // результатами
+  net::Log::SetOutput(stderr);
+  Fixture echo;
+  fixture = &echo;
+  return bench::Registry::Instance().Main("echo", argc, argv);
+}
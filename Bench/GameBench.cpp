@@ -0,0 +1,123 @@
+﻿#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Battleship.h"
+#include "BitBattleship.h"
+#include "Bench.h"
+#include "FleetGenerator.h"
+
+// Ядро игры: расстановка, выстрел и текст доски
+
+namespace {
+constexpr int CELLS = BOARD_SIZE * BOARD_SIZE;
+
+// Все клетки доски в случайном порядке, как их назвал бы клиент
+std::vector<std::string> ShuffledCells() {
+  std::vector<std::string> cells;
+  for (int index = 0; index < CELLS; ++index) {
+    cells.push_back({static_cast<char>('a' + index % BOARD_SIZE),
+                     static_cast<char>('0' + index / BOARD_SIZE)});
+  }
+  std::shuffle(cells.begin(), cells.end(), std::mt19937(42));
+  return cells;
+}
+
+// Итерация - один выстрел. Доски создаются пачками вне замера, и по каждой
+// делается выстрел в каждую клетку. В замер попадают промахи, ранения и
+// потопления с открытием клеток вокруг, но не повторы
+template <typename Game, typename Shoot>
+void AttackAllCells(bench::Run& run, Shoot shoot) {
+  constexpr size_t GAMES_PER_CHUNK = 64;
+  const auto cells = ShuffledCells();
+  std::vector<Fleet> fleets(GAMES_PER_CHUNK);
+  FleetGenerator::Generate(fleets);
+
+  std::vector<std::unique_ptr<Game>> games;
+  uint64_t done = 0;
+  while (done < run.iterations) {
+    run.PauseTiming();
+    games.clear();
+    for (auto& fleet : fleets) games.push_back(std::make_unique<Game>(fleet));
+    run.ResumeTiming();
+
+    for (auto& game : games) {
+      for (int cell = 0; cell < CELLS && done < run.iterations;
+           ++cell, ++done) {
+        bench::DoNotOptimize(shoot(*game, cells[cell]));
+      }
+    }
+  }
+  run.SetItems(run.iterations);
+}
+
+bench::Register generate("fleet_generator/generate", [](bench::Run& run) {
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    bench::DoNotOptimize(FleetGenerator::Generate());
+  }
+  run.SetItems(run.iterations);
+});
+
+bench::Register construct("battleship/construct", [](bench::Run& run) {
+  // Конструктор заводит доски и вызывает RandomArrangement: столько стоит
+  // подготовка одной новой партии
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    Battleship game;
+    bench::DoNotOptimize(game);
+  }
+  run.SetItems(run.iterations);
+});
+
+bench::Register random_arrangement(
+    "battleship/random_arrangement", [](bench::Run& run) {
+      Battleship game;
+      for (uint64_t i = 0; i < run.iterations; ++i) {
+        game.RandomArrangement();
+        bench::DoNotOptimize(game);
+      }
+      run.SetItems(run.iterations);
+    });
+
+bench::Register attack("battleship/attack", [](bench::Run& run) {
+  AttackAllCells<Battleship>(run, [](Battleship& game,
+                                     const std::string& cell) {
+    return game.Attack(cell);
+  });
+});
+
+bench::Register bit_attack("bitbattleship/attack", [](bench::Run& run) {
+  AttackAllCells<BitBattleship>(run, [](BitBattleship& game,
+                                        const std::string& cell) {
+    return game.Attack(cell.at(1) - '0', cell.at(0) - 'a');
+  });
+});
+
+// Доска в середине партии: половина клеток уже открыта. Сам GetBoard
+// возвращает готовое представление, поэтому замеряется его копирование в
+// строку, как при отправке доски клиенту
+template <bool hiden>
+void GetBoard(bench::Run& run) {
+  Battleship game;
+  const auto cells = ShuffledCells();
+  for (int cell = 0; cell < CELLS / 2; ++cell) game.Attack(cells[cell]);
+
+  size_t bytes = 0;
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    std::string_view board = game.GetBoard(hiden);
+    std::string text(board);
+    bench::DoNotOptimize(text);
+    bytes += board.size();
+  }
+  run.SetItems(run.iterations);
+  run.SetBytes(bytes);
+}
+
+bench::Register get_board("battleship/get_board", GetBoard<false>);
+bench::Register get_board_hiden("battleship/get_board_hiden", GetBoard<true>);
+}
+
+int main(int argc, char* argv[]) {
+  return bench::Registry::Instance().Main("game", argc, argv);
+}
@@ -0,0 +1,143 @@
+﻿#include <Net.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench.h"
+
+// Очереди входящих сообщений и сериализация Message<T>
+
+namespace {
+enum class MessageTypes : uint32_t { Bench };
+
+using Message = net::Message<MessageTypes>;
+using OwnedMessage = net::OwnedMessage<MessageTypes>;
+
+// Типичный ответ на выстрел и тело побольше
+struct ShotResult {
+  uint8_t x = 0;
+  uint8_t y = 0;
+  uint8_t shot = 0;
+};
+
+struct Payload {
+  uint64_t words[8] = {};
+};
+
+// Примерно столько занимает текст доски 10x10 с подписями
+constexpr size_t BOARD_TEXT_BYTES = 256;
+
+template <typename Queue>
+void PushPop(bench::Run& run) {
+  Queue queue;
+  OwnedMessage message;
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    queue.PushBack(message);
+    bench::DoNotOptimize(queue.PopFront());
+  }
+  run.SetItems(run.iterations);
+}
+
+// Производитель в отдельном потоке, потребитель ждёт и забирает всё разом,
+// как это делает IServer::Update
+template <typename Queue>
+void ProducerConsumer(bench::Run& run) {
+  Queue queue;
+  std::thread producer([&]() {
+    OwnedMessage message;
+    for (uint64_t i = 0; i < run.iterations; ++i) queue.PushBack(message);
+  });
+
+  std::vector<OwnedMessage> batch;
+  uint64_t received = 0;
+  while (received < run.iterations) {
+    queue.Wait();
+    received += queue.DrainInto(batch);
+    batch.clear();
+  }
+  producer.join();
+  run.SetItems(run.iterations);
+}
+
+bench::Register tsdeque_push_pop("tsdeque/push_pop",
+                                 PushPop<net::TSDeque<OwnedMessage>>);
+bench::Register tsdeque_threads(
+    "tsdeque/producer_consumer",
+    ProducerConsumer<net::TSDeque<OwnedMessage>>);
+bench::Register mpsc_push_pop("mpscqueue/push_pop",
+                              PushPop<net::MPSCQueue<OwnedMessage>>);
+bench::Register mpsc_threads("mpscqueue/producer_consumer",
+                             ProducerConsumer<net::MPSCQueue<OwnedMessage>>);
+
+// operator<< и operator>>: поле дописывается в конец и снимается с конца
+template <typename DataType>
+void ShiftOperators(bench::Run& run) {
+  DataType data{};
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    Message message;
+    message << data;
+    message >> data;
+    bench::DoNotOptimize(data);
+  }
+  run.SetBytes(run.iterations * sizeof(DataType));
+}
+
+bench::Register shift_small("message/shift_shot_result",
+                            ShiftOperators<ShotResult>);
+bench::Register shift_payload("message/shift_payload_64b",
+                              ShiftOperators<Payload>);
+
+// Ответ сервера на выстрел: несколько полей одним Write и чтение по порядку
+void WriterReader(bench::Run& run) {
+  uint32_t game_id = 7;
+  ShotResult result;
+  Payload payload;
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    Message message;
+    net::MessageWriter(message, sizeof(game_id) + sizeof(result) +
+                                    sizeof(payload))
+        .Write(game_id, result, payload);
+    net::MessageReader reader(message);
+    reader.Read(game_id, result, payload);
+    bench::DoNotOptimize(payload);
+  }
+  run.SetBytes(run.iterations *
+               (sizeof(game_id) + sizeof(result) + sizeof(payload)));
+}
+
+bench::Register writer_reader("message/writer_reader", WriterReader);
+
+// Строка с длиной, например текст доски. Читается без копирования
+void WriteReadString(bench::Run& run) {
+  const std::string text(BOARD_TEXT_BYTES, '@');
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    Message message;
+    net::MessageWriter(message).WriteString(text);
+    net::MessageReader reader(message);
+    bench::DoNotOptimize(reader.ReadString());
+  }
+  run.SetBytes(run.iterations * text.size());
+}
+
+bench::Register write_read_string("message/write_read_string",
+                                  WriteReadString);
+
+// Рассылка: тело сериализуется один раз, получатели делят его
+void MakeShared(bench::Run& run) {
+  Payload payload;
+  for (uint64_t i = 0; i < run.iterations; ++i) {
+    Message message;
+    net::MessageWriter(message).Write(payload);
+    auto shared = net::MakeSharedMessage(std::move(message));
+    bench::DoNotOptimize(shared);
+  }
+  run.SetItems(run.iterations);
+}
+
+bench::Register shared_message("message/make_shared", MakeShared);
+}
+
+int main(int argc, char* argv[]) {
+  return bench::Registry::Instance().Main("net", argc, argv);
+}
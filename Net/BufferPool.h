@@ -0,0 +1,216 @@
+﻿#pragma once
+
+#include "Common.h"
+
+namespace net {
+// Пул блоков памяти под тела сообщений. Блоки разбиты на классы по размеру
+// (степени двойки от 64 байт до 64 КБ). У каждого потока свой кэш
+// свободных блоков, излишки уходят в общий список класса, откуда их
+// забирают другие потоки: сообщения обычно создаются в потоке ввода-вывода,
+// а освобождаются в потоке игровой логики. Общий список класса хранит не
+// больше CENTRAL_MAX_BYTES, остальное возвращается в кучу, так что пик
+// нагрузки не держит свою память до конца процесса
+class BufferPool {
+ public:
+  static constexpr size_t MIN_BLOCK_SIZE = 64;
+  static constexpr size_t CLASSES_COUNT = 11;
+  static constexpr size_t THREAD_CACHE_BLOCKS = 64;
+  static constexpr size_t CENTRAL_MAX_BYTES = 4 * 1024 * 1024;
+
+  struct Stats {
+    // Блок выдан из пула
+    uint64_t hits = 0;
+    // Пул пуст, блок выделен в куче
+    uint64_t misses = 0;
+    // Запрос больше самого крупного класса, память мимо пула
+    uint64_t oversize = 0;
+    // Блоки, не поместившиеся в общий список и возвращённые в кучу
+    uint64_t trimmed = 0;
+  };
+
+ public:
+  static void* Allocate(size_t bytes) {
+    size_t size_class = ClassOf(bytes);
+    if (size_class == CLASSES_COUNT) {
+      oversize_.fetch_add(1, std::memory_order_relaxed);
+      return ::operator new(bytes);
+    }
+
+    ThreadCache* cache = Cache();
+    if (!cache) {
+      void* block = TakeCentral(size_class);
+      if (block) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return block;
+      }
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return ::operator new(BlockSize(size_class));
+    }
+
+    auto& blocks = cache->blocks[size_class];
+    if (blocks.empty()) {
+      Refill(size_class, blocks);
+    }
+    if (blocks.empty()) {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+      return ::operator new(BlockSize(size_class));
+    }
+
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    void* block = blocks.back();
+    blocks.pop_back();
+    return block;
+  }
+
+  static void Release(void* block, size_t bytes) {
+    size_t size_class = ClassOf(bytes);
+    if (size_class == CLASSES_COUNT) {
+      ::operator delete(block);
+      return;
+    }
+
+    ThreadCache* cache = Cache();
+    if (!cache) {
+      std::vector<void*> blocks{block};
+      Spill(size_class, blocks, 1);
+      return;
+    }
+
+    auto& blocks = cache->blocks[size_class];
+    blocks.push_back(block);
+    if (blocks.size() > THREAD_CACHE_BLOCKS) {
+      Spill(size_class, blocks, THREAD_CACHE_BLOCKS / 2);
+    }
+  }
+
+  static Stats GetStats() {
+    Stats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.oversize = oversize_.load(std::memory_order_relaxed);
+    stats.trimmed = trimmed_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  struct Central {
+    std::mutex mutex;
+    std::vector<void*> blocks;
+
+    ~Central() {
+      for (void* block : blocks) ::operator delete(block);
+    }
+  };
+
+  struct ThreadCache {
+    std::vector<void*> blocks[CLASSES_COUNT];
+
+    ThreadCache() {
+      for (auto& list : blocks) list.reserve(THREAD_CACHE_BLOCKS + 1);
+    }
+    // Поток завершается, его блоки отдаём в общие списки. Блоки, которые
+    // освободят деструкторы, выполняемые позже, идут туда же, см. Cache()
+    ~ThreadCache() {
+      cache_destroyed_ = true;
+      for (size_t i = 0; i < CLASSES_COUNT; ++i) {
+        Spill(i, blocks[i], blocks[i].size());
+      }
+    }
+  };
+
+  static size_t BlockSize(size_t size_class) {
+    return MIN_BLOCK_SIZE << size_class;
+  }
+
+  // Номер класса или CLASSES_COUNT, если блок слишком большой
+  static size_t ClassOf(size_t bytes) {
+    size_t size_class = 0;
+    while (size_class < CLASSES_COUNT && BlockSize(size_class) < bytes) {
+      ++size_class;
+    }
+    return size_class;
+  }
+
+  static void Refill(size_t size_class, std::vector<void*>& blocks) {
+    auto& central = CentralList(size_class);
+    std::scoped_lock lock(central.mutex);
+    size_t count = std::min(central.blocks.size(), THREAD_CACHE_BLOCKS / 2);
+    blocks.insert(blocks.end(), central.blocks.end() - count,
+                  central.blocks.end());
+    central.blocks.resize(central.blocks.size() - count);
+  }
+
+  static void* TakeCentral(size_t size_class) {
+    auto& central = CentralList(size_class);
+    std::scoped_lock lock(central.mutex);
+    if (central.blocks.empty()) return nullptr;
+    void* block = central.blocks.back();
+    central.blocks.pop_back();
+    return block;
+  }
+
+  // Отдаёт count последних блоков в общий список, а не поместившиеся в
+  // него освобождает уже без блокировки
+  static void Spill(size_t size_class, std::vector<void*>& blocks,
+                    size_t count) {
+    auto& central = CentralList(size_class);
+    size_t capacity = std::max(THREAD_CACHE_BLOCKS,
+                               CENTRAL_MAX_BYTES / BlockSize(size_class));
+    size_t kept = 0;
+    {
+      std::scoped_lock lock(central.mutex);
+      kept = std::min(count, capacity - std::min(capacity,
+                                                 central.blocks.size()));
+      central.blocks.insert(central.blocks.end(), blocks.end() - count,
+                            blocks.end() - count + kept);
+    }
+    for (auto it = blocks.end() - count + kept; it != blocks.end(); ++it) {
+      ::operator delete(*it);
+    }
+    if (kept < count) {
+      trimmed_.fetch_add(count - kept, std::memory_order_relaxed);
+    }
+    blocks.resize(blocks.size() - count);
+  }
+
+  static Central& CentralList(size_t size_class) {
+    static Central central[CLASSES_COUNT];
+    return central[size_class];
+  }
+
+  // nullptr, если кэш потока уже уничтожен: поток завершается, а память
+  // ещё освобождают деструкторы других thread_local объектов. Флаг
+  // тривиально разрушаемый и остаётся доступным до конца потока
+  static ThreadCache* Cache() {
+    if (cache_destroyed_) return nullptr;
+    thread_local ThreadCache cache;
+    return &cache;
+  }
+
+  inline static std::atomic<uint64_t> hits_ = 0;
+  inline static std::atomic<uint64_t> misses_ = 0;
+  inline static std::atomic<uint64_t> oversize_ = 0;
+  inline static std::atomic<uint64_t> trimmed_ = 0;
+  inline static thread_local bool cache_destroyed_ = false;
+};
+
+// Аллокатор для контейнеров, берущий память из BufferPool
+template <typename U>
+struct PoolAllocator {
+  using value_type = U;
+
+  PoolAllocator() = default;
+  template <typename V>
+  PoolAllocator(const PoolAllocator<V>&) {}
+
+  U* allocate(size_t n) {
+    return static_cast<U*>(BufferPool::Allocate(n * sizeof(U)));
+  }
+  void deallocate(U* p, size_t n) { BufferPool::Release(p, n * sizeof(U)); }
+
+  template <typename V>
+  bool operator==(const PoolAllocator<V>&) const {
+    return true;
+  }
+};
+}
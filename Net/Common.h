@@ -1,20 +1,49 @@
-#pragma once
+﻿#pragma once
 
 #include <memory>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <deque>
 #include <vector>
 #include <iostream>
 #include <algorithm>
+#include <iterator>
 #include <cstdint>
+#include <functional>
+#include <chrono>
+#include <condition_variable>
+#include <optional>
+#include <span>
+#include <utility>
 
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0A00
 #endif
 
+// Если standalone ASIO нет, а есть Boost, собираемся с Boost.Asio: API тот
+// же, меняется только пространство имён
+#ifdef NET_USE_BOOST_ASIO
+#include <boost/asio.hpp>
+#include <boost/asio/ts/buffer.hpp>
+#include <boost/asio/ts/internet.hpp>
+namespace asio = boost::asio;
+#else
 #define ASIO_STANDALONE
 #include <asio.hpp>
 #include <asio/ts/buffer.hpp>
 #include <asio/ts/internet.hpp>
+#endif
+
+namespace net {
+// Тип ошибки в обработчиках ASIO, нужен там, где он должен совпадать
+// точно, например в asio::redirect_error. system_error - исключение с ним
+#ifdef NET_USE_BOOST_ASIO
+using error_code = boost::system::error_code;
+using system_error = boost::system::system_error;
+#else
+using error_code = asio::error_code;
+using system_error = asio::system_error;
+#endif
+}
 
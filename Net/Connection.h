@@ -1,174 +1,727 @@
 ﻿#pragma once
 
 #include "Common.h"
+#include "HandlerAllocator.h"
+#include "Log.h"
 #include "Message.h"
+#include "Metrics.h"
+#include "MPSCQueue.h"
+#include "Transport.h"
 #include "TSDeque.h"
 
 namespace net {
-template <typename T>
-class Connection : public std::enable_shared_from_this<Connection<T>> {
+// Transport - один из транспортов из Transport.h, от него зависят только
+// сокет и подключение
+template <typename T, typename Transport>
+class Connection
+    : public std::enable_shared_from_this<Connection<T, Transport>> {
  public:
   // Соединение принадлежит либо серверу, либо сокету, их поведение немного
   // разное
   enum class owner { server, client };
 
+  // exact - два точных async_read на сообщение (заголовок, затем тело),
+  // buffered - async_read_some в большой буфер соединения и разбор из него
+  // всех целых сообщений сразу
+  enum class read_mode { exact, buffered };
+
+  // Что делать, когда клиент не успевает читать и очередь отправки
+  // превысила верхний предел:
+  // drop_oldest - выбросить самые старые ещё не начатые сообщения,
+  // coalesce - выбросить старые сообщения, которые заменяет новое (например,
+  // прежние состояния той же доски), а если заменять нечего - отключить,
+  // disconnect - сразу отключить клиента
+  enum class overflow_policy { drop_oldest, coalesce, disconnect };
+
+  using Socket = typename Transport::Socket;
+  using Endpoint = typename Transport::Endpoint;
+
+  using Strand = asio::strand<asio::io_context::executor_type>;
+  // Корутина в strand соединения. Executor известен по типу, поэтому ASIO
+  // не упаковывает strand в any_io_executor (в кучу) на каждой операции
+  template <typename Result>
+  using Awaitable = asio::awaitable<Result, Strand>;
+
+  // Пределы очереди отправки. Очередь переполнена, когда превышен любой из
+  // верхних пределов, и считается разгруженной, когда опустилась ниже
+  // обоих нижних
+  struct SendLimits {
+    size_t high_water_bytes = 4 * 1024 * 1024;
+    size_t low_water_bytes = 1024 * 1024;
+    size_t high_water_messages = 4096;
+    size_t low_water_messages = 1024;
+    overflow_policy policy = overflow_policy::disconnect;
+    // Для coalesce: true, если newer делает older ненужным. По умолчанию
+    // новое сообщение заменяет старые того же типа
+    std::function<bool(const Message<T>& older, const Message<T>& newer)>
+        supersedes;
+  };
+
+  // Счётчики соединения. Меняются только внутри strand, а GetStats() можно
+  // вызывать из любого потока
+  struct Stats {
+    uint64_t messages_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t messages_out = 0;
+    uint64_t bytes_out = 0;
+    // Сейчас в очереди отправки, включая пишущуюся пачку
+    uint64_t queued_messages = 0;
+    uint64_t queued_bytes = 0;
+  };
+
  public:
-  Connection(owner parent, asio::io_context& asioContext,
-             asio::ip::tcp::socket socket, TSDeque<OwnedMessage<T>>& qIn)
-      : context_(asioContext),
-        socket_(std::move(socket)),
+  Connection(owner parent, asio::io_context& asioContext, Socket socket,
+             IncomingQueue<OwnedMessage<T, Transport>>& qIn)
+      : socket_(std::move(socket)),
+        context_(asioContext),
+        strand_(asio::make_strand(asioContext)),
+        inbox_signal_(strand_, Signal::time_point::max()),
+        send_signal_(strand_, Signal::time_point::max()),
         messages_in(qIn),
         owner_type_(parent) {}
 
-  virtual ~Connection() {}
+  // Не отправленные сообщения уходят из глубины очередей отправки
+  virtual ~Connection() {
+    Metrics::Add(Metrics::counter::messages_dropped, queued_messages_);
+  }
 
   uint32_t GetID() const { return id; }
 
+  // Handle сессии пользователя сервера (например, партии), привязанной к
+  // соединению. Задаётся в OnClientConnect, до начала чтения
+  uint32_t GetSession() const { return session_; }
+  void SetSession(uint32_t session) { session_ = session; }
+
+  // Входящие сообщения и уведомление об отключении вместо очереди
+  // передаются handler прямо в strand соединения, то есть в потоке ASIO
+  // context. Задаётся до подключения
+  void SetMessageHandler(
+      std::function<void(OwnedMessage<T, Transport>&)> handler) {
+    message_handler_ = std::move(handler);
+  }
+
+  // Вызывать до начала чтения, например из OnClientConnect
+  void SetReadMode(read_mode mode, size_t buffer_size = 64 * 1024) {
+    read_mode_ = mode;
+    read_buffer_size_ = buffer_size;
+  }
+
+  // Сообщения и отключение достаются корутине сессии через Receive(), а не
+  // очереди сервера. Вызывать до ConnectToClient
+  void EnableSession() { session_mode_ = true; }
+
+  // В нём выполняются все обработчики соединения. Корутина, запущенная
+  // в нём через co_spawn, может звать Receive() и AsyncSend()
+  const Strand& GetStrand() const {
+    return strand_;
+  }
+
  public:
   void ConnectToClient(uint32_t uid = 0) {
     if (owner_type_ == owner::server) {
       if (socket_.is_open()) {
         id = uid;
-        ReadHeader();
+        // Все операции соединения выполняются только внутри его strand
+        asio::post(strand_,
+                   BindHandlerMemory(handler_memory_,
+                                     [this, self = this->shared_from_this()]() {
+                                       StartRead();
+                                     }));
       }
     }
   }
   //  Выполняет ASIO context
-  void ConnectToServer(const asio::ip::tcp::resolver::results_type& endpoints) {
+  //  Подключение к одному адресу транспорта
+  void ConnectToServer(const Endpoint& endpoint) {
+    if (owner_type_ == owner::client) {
+      socket_.async_connect(
+          endpoint, asio::bind_executor(strand_, ConnectHandler()));
+    }
+  }
+
+  //  Выполняет ASIO context
+  //  Подключение к первому ответившему из адресов, например к результату
+  //  resolve для TCP
+  template <typename Endpoints>
+  void ConnectToServer(const Endpoints& endpoints) {
     if (owner_type_ == owner::client) {
       // ASIO пытается подключиться к endpoints
-      asio::async_connect(
-          socket_, endpoints,
-          [this](std::error_code ec, asio::ip::tcp::endpoint endpoint) {
-            if (!ec) {
-              ReadHeader();
-            }
-          });
+      asio::async_connect(socket_, endpoints,
+                          asio::bind_executor(strand_, ConnectHandler()));
     }
   }
   //  Выполняет ASIO context
   void Disconnect() {
     if (IsConnected()) {
       // пытаемся закрыть сокет post создаёт функцию, а ASIO выполняет асинхронно
-      asio::post(context_, [this]() { socket_.close(); });
+      asio::post(strand_,
+                 BindHandlerMemory(handler_memory_,
+                                   [this, self = this->shared_from_this()]() {
+                                     socket_.close();
+                                   }));
     }
   }
 
   bool IsConnected() const { return socket_.is_open(); }
 
  public:
-  void Send(const Message<T>& message) {
-    asio::post(context_, [this, message]() {
-      bool writing_message = !messages_out_.Empty();
-      messages_out_.PushBack(message);
-      if (!writing_message) {
-        WriteHeader();
-      }
-    });
+  void Send(const Message<T>& message) { Send(MakeSharedMessage(message)); }
+
+  // Сообщение не копируется, в очередь попадает только указатель на него
+  void Send(SharedMessage<T> message) {
+    // Из самого strand (сессия, обработчик клиента в режиме callback)
+    // ставим в очередь сразу, без post
+    if (strand_.running_in_this_thread()) {
+      Enqueue(std::move(message), Metrics::SendTime());
+      return;
+    }
+    // Из других потоков сообщения копятся в pending_sends_, и в strand
+    // уходит один обработчик на всю пачку: сколько бы Send ни пришло, пока
+    // он не выполнился, блоков HandlerMemory на них хватит
+    bool post = false;
+    {
+      std::scoped_lock lock(pending_mutex_);
+      post = pending_sends_.empty();
+      pending_sends_.push_back({std::move(message), Metrics::SendTime()});
+    }
+    if (!post) return;
+    asio::post(strand_,
+               BindHandlerMemory(handler_memory_,
+                                 [this, self = this->shared_from_this()]() {
+                                   EnqueuePending();
+                                 }));
+  }
+
+  //  Выполняет корутина сессии в strand соединения
+  //  Следующее сообщение клиента. nullopt - соединение закрыто, и все
+  //  сообщения, пришедшие до этого, уже получены
+  Awaitable<std::optional<Message<T>>> Receive() {
+    while (inbox_.empty() && !disconnect_reported_) {
+      error_code ec;
+      inbox_waiting_ = true;
+      co_await inbox_signal_.async_wait(
+          asio::redirect_error(asio::use_awaitable_t<Strand>(), ec));
+      inbox_waiting_ = false;
+    }
+    if (inbox_.empty()) co_return std::nullopt;
+
+    Incoming incoming = std::move(inbox_.front());
+    inbox_.pop_front();
+    Metrics::Record(Metrics::histogram::receive_to_handle,
+                    Metrics::Clock::now() - incoming.received);
+    co_return std::move(incoming.message);
+  }
+
+  //  Выполняет корутина сессии в strand соединения
+  //  Ставит сообщение в очередь отправки сразу, без post, и возвращается,
+  //  когда очередь не под давлением: медленный клиент так тормозит свою
+  //  сессию. false, если соединение закрыто. Из чужого strand (например,
+  //  из сессии другого клиента) работает как обычный Send
+  Awaitable<bool> AsyncSend(SharedMessage<T> message) {
+    if (!strand_.running_in_this_thread()) {
+      Send(std::move(message));
+      co_return IsConnected();
+    }
+
+    Enqueue(std::move(message), Metrics::SendTime());
+    while (backpressure_.load(std::memory_order_relaxed) &&
+           socket_.is_open()) {
+      error_code ec;
+      send_waiting_ = true;
+      co_await send_signal_.async_wait(
+          asio::redirect_error(asio::use_awaitable_t<Strand>(), ec));
+      send_waiting_ = false;
+    }
+    co_return socket_.is_open();
+  }
+
+  Awaitable<bool> AsyncSend(const Message<T>& message) {
+    return AsyncSend(MakeSharedMessage(message));
+  }
+
+  void SetSendLimits(SendLimits limits) {
+    asio::post(strand_,
+               BindHandlerMemory(handler_memory_,
+                                 [this, self = this->shared_from_this(),
+                                  limits = std::move(limits)]() mutable {
+                                   send_limits_ = std::move(limits);
+                                 }));
+  }
+
+  // true, пока очередь отправки выше верхнего предела и ещё не разгрузилась
+  // до нижнего: таким клиентам стоит слать только самое важное
+  bool IsBackpressured() const {
+    return backpressure_.load(std::memory_order_relaxed);
+  }
+
+  Stats GetStats() const {
+    Stats stats;
+    stats.messages_in = stats_.messages_in.load(std::memory_order_relaxed);
+    stats.bytes_in = stats_.bytes_in.load(std::memory_order_relaxed);
+    stats.messages_out = stats_.messages_out.load(std::memory_order_relaxed);
+    stats.bytes_out = stats_.bytes_out.load(std::memory_order_relaxed);
+    stats.queued_messages =
+        stats_.queued_messages.load(std::memory_order_relaxed);
+    stats.queued_bytes = stats_.queued_bytes.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  // Ограничение на размер одной пачки записи. Сообщение больше лимита всё
+  // равно уходит, но одно
+  void SetMaxFlushBytes(size_t bytes) {
+    asio::post(strand_,
+               BindHandlerMemory(handler_memory_,
+                                 [this, self = this->shared_from_this(),
+                                  bytes]() { max_flush_bytes_ = bytes; }));
   }
 
  private:
+  // Сообщение в очереди отправки и время, от которого считается
+  // handle_to_write
+  struct Outgoing {
+    SharedMessage<T> message;
+    Metrics::Clock::time_point queued_at;
+  };
+
+  // Сообщение, ждущее корутину сессии
+  struct Incoming {
+    Message<T> message;
+    Metrics::Clock::time_point received;
+  };
+
+  // Адрес, к которому в итоге подключились, не нужен
+  auto ConnectHandler() {
+    return [this, self = this->shared_from_this()](std::error_code ec,
+                                                   auto&&...) {
+      if (!ec) {
+        StartRead();
+      } else {
+        Log::Warning("Connect Fail: {}", ec);
+        ReportDisconnect();
+      }
+    };
+  }
+
   //  Выполняет ASIO context
-  void WriteHeader() {
-    asio::async_write(
-        socket_,
-        asio::buffer(&messages_out_.Front().header, sizeof(MessageHeader<T>)),
-        [this](std::error_code ec, std::size_t length) {
-          if (!ec) {
-            if (messages_out_.Front().body.size() > 0) {
-              WriteBody();
-            } else {
-              messages_out_.PopFront();
-              if (!messages_out_.Empty()) {
-                WriteHeader();
-              }
-            }
-          } else {
-            std::cout << "[" << id << "] Write Header Fail.\n";
-            socket_.close();
-          }
-        });
+  //  Забирает всё, что накопили Send из других потоков. Оба вектора
+  //  сохраняют ёмкость, так что в установившемся режиме память не
+  //  выделяется
+  void EnqueuePending() {
+    {
+      std::scoped_lock lock(pending_mutex_);
+      std::swap(pending_sends_, enqueuing_sends_);
+    }
+    for (auto& outgoing : enqueuing_sends_) {
+      Enqueue(std::move(outgoing.message), outgoing.queued_at);
+    }
+    enqueuing_sends_.clear();
+  }
+
+  void Enqueue(SharedMessage<T> message,
+               Metrics::Clock::time_point queued_at) {
+    // Закрытому соединению копить сообщения незачем
+    if (!socket_.is_open()) return;
+
+    queued_bytes_ += FrameSize(*message);
+    ++queued_messages_;
+    Metrics::Add(Metrics::counter::messages_queued);
+    messages_out_.push_back({std::move(message), queued_at});
+    if (OverHighWater()) {
+      backpressure_.store(true, std::memory_order_relaxed);
+      if (!HandleOverflow()) return;
+    }
+    PublishQueue();
+
+    // Если запись уже идёт, сообщение уйдёт следующей пачкой
+    if (messages_writing_.empty()) {
+      Write();
+    }
+  }
+
+  // Будит сессию, ждущую в Receive() или AsyncSend()
+  void WakeReceiver() {
+    if (inbox_waiting_) inbox_signal_.cancel();
+  }
+
+  void WakeSender() {
+    if (send_waiting_) send_signal_.cancel();
+  }
+
+  static size_t FrameSize(const Message<T>& message) {
+    return sizeof(MessageHeader<T>) + message.body.size();
+  }
+
+  bool OverHighWater() const {
+    return queued_bytes_ > send_limits_.high_water_bytes ||
+           queued_messages_ > send_limits_.high_water_messages;
+  }
+
+  bool BelowLowWater() const {
+    return queued_bytes_ <= send_limits_.low_water_bytes &&
+           queued_messages_ <= send_limits_.low_water_messages;
   }
 
   //  Выполняет ASIO context
-  void WriteBody() {
+  //  Сообщения, которые уже пишутся, не трогаем. false, если клиент
+  //  отключён
+  bool HandleOverflow() {
+    switch (send_limits_.policy) {
+      case overflow_policy::drop_oldest:
+        // Последнее, только что добавленное сообщение остаётся
+        while (OverHighWater() && messages_out_.size() > 1) {
+          DropQueued(messages_out_.begin());
+        }
+        return true;
+
+      case overflow_policy::coalesce: {
+        const Message<T>& newer = *messages_out_.back().message;
+        auto last = std::prev(messages_out_.end());
+        auto kept = std::remove_if(
+            messages_out_.begin(), last, [&](const Outgoing& older) {
+              bool superseded =
+                  send_limits_.supersedes
+                      ? send_limits_.supersedes(*older.message, newer)
+                      : older.message->header.id == newer.header.id;
+              if (superseded) {
+                queued_bytes_ -= FrameSize(*older.message);
+                --queued_messages_;
+                Metrics::Add(Metrics::counter::messages_dropped);
+              }
+              return superseded;
+            });
+        messages_out_.erase(kept, last);
+        if (!OverHighWater()) return true;
+      } break;
 
-    asio::async_write(socket_,
-                      asio::buffer(messages_out_.Front().body.data(),
-                                   messages_out_.Front().body.size()),
-                      [this](std::error_code ec, std::size_t length) {
-                        if (!ec) {
-                          messages_out_.PopFront();
+      case overflow_policy::disconnect:
+        break;
+    }
+
+    Log::Warning("[{}] Send Queue Overflow, {} messages, {} bytes.", id,
+                 queued_messages_, queued_bytes_);
+    while (!messages_out_.empty()) {
+      DropQueued(messages_out_.begin());
+    }
+    // Ожидающее чтение завершится ошибкой, и сервер получит уведомление об
+    // отключении как обычно
+    socket_.close();
+    PublishQueue();
+    WakeSender();
+    return false;
+  }
+
+  auto DropQueued(typename std::deque<Outgoing>::iterator it) {
+    queued_bytes_ -= FrameSize(*it->message);
+    --queued_messages_;
+    Metrics::Add(Metrics::counter::messages_dropped);
+    return messages_out_.erase(it);
+  }
+
+  // Глубина очереди отправки для GetStats()
+  void PublishQueue() {
+    stats_.queued_messages.store(queued_messages_, std::memory_order_relaxed);
+    stats_.queued_bytes.store(queued_bytes_, std::memory_order_relaxed);
+  }
 
-                          if (!messages_out_.Empty()) {
-                            WriteHeader();
-                          }
-                        } else {
-                          std::cout << "[" << id << "] Write Body Fail.\n";
-                          socket_.close();
-                        }
-                      });
+  // Пишет только strand соединения, поэтому хватает load и store
+  static void Bump(std::atomic<uint64_t>& value, uint64_t delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta,
+                std::memory_order_relaxed);
   }
 
   //  Выполняет ASIO context
-  void ReadHeader() {
-    asio::async_read(
-        socket_,
-        asio::buffer(&temp_message_in_.header, sizeof(MessageHeader<T>)),
-        [this](std::error_code ec, std::size_t length) {
+  //  Собирает всю очередь исходящих сообщений (в пределах лимита) в один
+  //  набор буферов и отправляет его одним async_write
+  void Write() {
+    size_t bytes = 0;
+    while (!messages_out_.empty()) {
+      size_t size = FrameSize(*messages_out_.front().message);
+      if (!messages_writing_.empty() && bytes + size > max_flush_bytes_) {
+        break;
+      }
+      bytes += size;
+      messages_writing_.push_back(std::move(messages_out_.front()));
+      messages_out_.pop_front();
+    }
+
+    write_buffers_.clear();
+    for (auto& outgoing : messages_writing_) {
+      const Message<T>& message = *outgoing.message;
+      write_buffers_.push_back(
+          asio::buffer(&message.header, sizeof(MessageHeader<T>)));
+      if (!message.body.empty()) {
+        write_buffers_.push_back(
+            asio::buffer(message.body.data(), message.body.size()));
+      }
+    }
+
+    // async_write копирует набор буферов в операцию, span копируется без
+    // выделения памяти
+    asio::async_write(
+        socket_, std::span<const asio::const_buffer>(write_buffers_),
+        asio::bind_executor(
+            strand_,
+            BindHandlerMemory(handler_memory_, [this,
+                                                self = this->shared_from_this()
+                                               ](std::error_code ec,
+                                                 std::size_t length) {
           if (!ec) {
-            // Полный заголовок сообщения прочитан, проверим, есть ли у этого 
-            // сообщения тело
-            if (temp_message_in_.header.size > 0) {
-              temp_message_in_.body.resize(temp_message_in_.header.size);
-              ReadBody();
-            } else {
-              AddToIncomingMessageQueue();
+            auto written = Metrics::Clock::now();
+            for (auto& outgoing : messages_writing_) {
+              queued_bytes_ -= FrameSize(*outgoing.message);
+              Metrics::Record(Metrics::histogram::handle_to_write,
+                              written - outgoing.queued_at);
+            }
+            queued_messages_ -= messages_writing_.size();
+            Bump(stats_.messages_out, messages_writing_.size());
+            Bump(stats_.bytes_out, length);
+            Metrics::Add(Metrics::counter::messages_out,
+                         messages_writing_.size());
+            Metrics::Add(Metrics::counter::bytes_out, length);
+            PublishQueue();
+            messages_writing_.clear();
+            if (BelowLowWater()) {
+              backpressure_.store(false, std::memory_order_relaxed);
+              WakeSender();
+            }
+            if (!messages_out_.empty()) {
+              Write();
             }
           } else {
-            std::cout << "[" << id << "] Read Header Fail.\n";
+            Log::Info("[{}] Write Fail: {}", id, ec);
             socket_.close();
+            WakeSender();
           }
-        });
+        })));
+  }
+
+  //  Выполняет ASIO context
+  void StartRead() {
+    asio::co_spawn(strand_, ReadLoop(this->shared_from_this()),
+                   asio::detached);
   }
 
   //  Выполняет ASIO context
-  void ReadBody() {
-    asio::async_read(socket_,
-                     asio::buffer(temp_message_in_.body.data(),
-                                  temp_message_in_.body.size()),
-                     [this](std::error_code ec, std::size_t length) {
-                       if (!ec) {
-                         AddToIncomingMessageQueue();
-                       } else {
-                         std::cout << "[" << id << "] Read Body Fail.\n";
-                         socket_.close();
-                       }
-                     });
-  }
-
-  void AddToIncomingMessageQueue() {
-    if (owner_type_ == owner::server)
-      messages_in.PushBack({this->shared_from_this(), temp_message_in_});
-    else
-      messages_in.PushBack({nullptr, temp_message_in_});
-    ReadHeader();
+  //  Корутина чтения в strand соединения
+  Awaitable<void> ReadLoop(
+      // Не используется: кадр корутины держит соединение живым, пока идёт
+      // чтение
+      [[maybe_unused]] std::shared_ptr<Connection> self) {
+    error_code ec;
+    auto token = asio::redirect_error(asio::use_awaitable_t<Strand>(), ec);
+
+    if (read_mode_ == read_mode::buffered) {
+      read_buffer_.resize(read_buffer_size_);
+      while (true) {
+        size_t length = co_await socket_.async_read_some(
+            asio::buffer(read_buffer_.data() + read_end_,
+                         read_buffer_.size() - read_end_),
+            token);
+        if (ec) {
+          ReadFail("Read");
+          co_return;
+        }
+        read_end_ += length;
+        if (!ParseFrames()) {
+          ReadFail("Oversized Message");
+          co_return;
+        }
+      }
+    }
+
+    while (true) {
+      co_await asio::async_read(
+          socket_,
+          asio::buffer(&temp_message_in_.header, sizeof(MessageHeader<T>)),
+          token);
+      if (ec) {
+        ReadFail("Read Header");
+        co_return;
+      }
+
+      if (temp_message_in_.header.size > MAX_MESSAGE_SIZE) {
+        ReadFail("Oversized Message");
+        co_return;
+      }
+
+      // Полный заголовок сообщения прочитан, проверим, есть ли у этого
+      // сообщения тело
+      temp_message_in_.body.resize(temp_message_in_.header.size);
+      if (temp_message_in_.header.size > 0) {
+        co_await asio::async_read(socket_,
+                                  asio::buffer(temp_message_in_.body.data(),
+                                               temp_message_in_.body.size()),
+                                  token);
+        if (ec) {
+          ReadFail("Read Body");
+          co_return;
+        }
+      }
+      PushIncoming(temp_message_in_, Metrics::Clock::now());
+    }
+  }
+
+  // Достаёт из буфера все целые сообщения, а начало незаконченного
+  // переносит в начало буфера до следующего чтения. false, если заголовок
+  // обещает тело больше MAX_MESSAGE_SIZE
+  bool ParseFrames() {
+    auto received = Metrics::Clock::now();
+    size_t begin = 0;
+    size_t required = 0;
+    while (read_end_ - begin >= sizeof(MessageHeader<T>)) {
+      MessageHeader<T> header;
+      std::memcpy(&header, read_buffer_.data() + begin, sizeof(header));
+      if (header.size > MAX_MESSAGE_SIZE) return false;
+
+      size_t frame = sizeof(MessageHeader<T>) + header.size;
+      if (read_end_ - begin < frame) {
+        required = frame;
+        break;
+      }
+
+      Message<T> message;
+      message.header = header;
+      const uint8_t* body = read_buffer_.data() + begin + sizeof(header);
+      message.body.assign(body, body + header.size);
+      PushIncoming(std::move(message), received);
+
+      begin += frame;
+    }
+
+    if (begin > 0) {
+      std::memmove(read_buffer_.data(), read_buffer_.data() + begin,
+                   read_end_ - begin);
+      read_end_ -= begin;
+    }
+    // Сообщение целиком не влезет в буфер, расширяем его
+    if (required > read_buffer_.size()) {
+      read_buffer_.resize(required);
+    }
+    return true;
+  }
+
+  // Чтение идёт всё время жизни соединения, поэтому любое отключение
+  // (закрытие сокета другой стороной, ошибка записи, Disconnect()) рано или
+  // поздно завершает его ошибкой. Отсюда владелец один раз получает
+  // уведомление вслед за последним сообщением соединения
+  void ReadFail(const char* operation) {
+    Log::Info("[{}] {} Fail.", id, operation);
+    socket_.close();
+    ReportDisconnect();
+  }
+
+  void ReportDisconnect() {
+    if (disconnect_reported_) return;
+    disconnect_reported_ = true;
+    if (session_mode_) {
+      WakeReceiver();
+      WakeSender();
+      return;
+    }
+    Deliver({Remote(), {}, true});
+  }
+
+  void PushIncoming(Message<T> message,
+                    Metrics::Clock::time_point received) {
+    size_t bytes = FrameSize(message);
+    Bump(stats_.messages_in, 1);
+    Bump(stats_.bytes_in, bytes);
+    Metrics::Add(Metrics::counter::messages_in);
+    Metrics::Add(Metrics::counter::bytes_in, bytes);
+    // Сессия в том же strand, поэтому сообщение отдаётся ей напрямую
+    if (session_mode_) {
+      inbox_.push_back({std::move(message), received});
+      WakeReceiver();
+      return;
+    }
+    Deliver({Remote(), std::move(message), false, received});
+  }
+
+  void Deliver(OwnedMessage<T, Transport> message) {
+    if (message_handler_) {
+      message_handler_(message);
+    } else {
+      // Очереди клиента разбирает пользователь, глубину считаем только у
+      // очередей сервера
+      if (owner_type_ == owner::server) {
+        Metrics::Add(Metrics::counter::incoming_pushed);
+      }
+      messages_in.PushBack(std::move(message));
+    }
+  }
+
+  // Клиенту отправитель не нужен, он всегда один - сервер
+  std::shared_ptr<Connection> Remote() {
+    if (owner_type_ == owner::server) return this->shared_from_this();
+    return nullptr;
   }
 
  protected:
   // Каждое соединение имеет уникальный сокет
-  asio::ip::tcp::socket socket_;
+  Socket socket_;
 
-  // Общий ASIO
+  // ASIO context из пула, к которому привязано соединение
   asio::io_context& context_;
-  TSDeque<Message<T>> messages_out_;
+  // Strand сериализует обработчики соединения, даже если context крутят
+  // несколько потоков
+  Strand strand_;
+  // Память для обработчиков post и async_write соединения
+  std::shared_ptr<HandlerMemory> handler_memory_ =
+      std::make_shared<HandlerMemory>();
+  // Сигналы для корутины сессии: таймеры никогда не срабатывают сами, их
+  // отменяют, чтобы разбудить ожидание
+  using Signal =
+      asio::basic_waitable_timer<std::chrono::steady_clock,
+                                 asio::wait_traits<std::chrono::steady_clock>,
+                                 Strand>;
+  Signal inbox_signal_;
+  Signal send_signal_;
+  // Send из других потоков, ждущие EnqueuePending
+  std::mutex pending_mutex_;
+  std::vector<Outgoing> pending_sends_;
+  std::vector<Outgoing> enqueuing_sends_;
+  // Очереди записи трогаются только внутри strand, поэтому без блокировок
+  std::deque<Outgoing> messages_out_;
+  // Сообщения, которые сейчас пишутся в сокет одной пачкой
+  std::vector<Outgoing> messages_writing_;
+  std::vector<asio::const_buffer> write_buffers_;
+  size_t max_flush_bytes_ = 64 * 1024;
+  // Сообщения в messages_out_ и messages_writing_ вместе
+  size_t queued_bytes_ = 0;
+  size_t queued_messages_ = 0;
+  SendLimits send_limits_;
+  std::atomic<bool> backpressure_ = false;
+
+  struct {
+    std::atomic<uint64_t> messages_in = 0;
+    std::atomic<uint64_t> bytes_in = 0;
+    std::atomic<uint64_t> messages_out = 0;
+    std::atomic<uint64_t> bytes_out = 0;
+    std::atomic<uint64_t> queued_messages = 0;
+    std::atomic<uint64_t> queued_bytes = 0;
+  } stats_;
 
-  TSDeque<OwnedMessage<T>>& messages_in;
+  IncomingQueue<OwnedMessage<T, Transport>>& messages_in;
+  std::function<void(OwnedMessage<T, Transport>&)> message_handler_;
 
   Message<T> temp_message_in_;
 
+  read_mode read_mode_ = read_mode::buffered;
+  size_t read_buffer_size_ = 64 * 1024;
+  // Буфер приёма в режиме buffered, данные лежат в [0, read_end_)
+  std::vector<uint8_t> read_buffer_;
+  size_t read_end_ = 0;
+
   owner owner_type_ = owner::server;
+  bool disconnect_reported_ = false;
+
+  // Входящие сообщения сессии, трогаются только внутри strand
+  bool session_mode_ = false;
+  std::deque<Incoming> inbox_;
+  bool inbox_waiting_ = false;
+  bool send_waiting_ = false;
 
   uint32_t id = 0;
+  uint32_t session_ = 0;
 };
 }
@@ -0,0 +1,76 @@
+﻿#pragma once
+
+#include "Common.h"
+
+namespace net {
+// Пул потоков ввода-вывода. Либо один общий ASIO context, который крутят
+// сразу несколько потоков, либо по собственному context на каждый поток
+class ContextPool {
+ public:
+  enum class mode { shared, per_thread };
+
+ public:
+  ContextPool(size_t threads = 1, mode pool_mode = mode::shared)
+      : mode_(pool_mode) {
+    if (threads == 0) threads = 1;
+    threads_count_ = threads;
+
+    size_t contexts = mode_ == mode::shared ? 1 : threads;
+    for (size_t i = 0; i < contexts; ++i) {
+      contexts_.push_back(std::make_unique<asio::io_context>(
+          mode_ == mode::shared ? static_cast<int>(threads) : 1));
+    }
+  }
+  ContextPool(const ContextPool&) = delete;
+
+  ~ContextPool() { Stop(); }
+
+ public:
+  // Context, которому принадлежит acceptor и прочие служебные задачи
+  asio::io_context& Main() { return *contexts_.front(); }
+
+  // Выдаёт context для нового соединения по кругу
+  asio::io_context& Next() {
+    size_t i = next_context_.fetch_add(1, std::memory_order_relaxed);
+    return *contexts_[i % contexts_.size()];
+  }
+
+  size_t ThreadsCount() const { return threads_count_; }
+  size_t ContextsCount() const { return contexts_.size(); }
+  mode Mode() const { return mode_; }
+
+  void Run() {
+    if (!threads_.empty()) return;
+
+    for (auto& context : contexts_) {
+      context->restart();
+      // Без guard'а context, у которого пока нет соединений, сразу завершится
+      guards_.emplace_back(asio::make_work_guard(*context));
+    }
+    for (size_t i = 0; i < threads_count_; ++i) {
+      asio::io_context& context = *contexts_[i % contexts_.size()];
+      threads_.emplace_back([&context]() { context.run(); });
+    }
+  }
+
+  void Stop() {
+    guards_.clear();
+    for (auto& context : contexts_) {
+      context->stop();
+    }
+    for (auto& thread : threads_) {
+      if (thread.joinable()) thread.join();
+    }
+    threads_.clear();
+  }
+
+ private:
+  mode mode_ = mode::shared;
+  size_t threads_count_ = 1;
+  std::vector<std::unique_ptr<asio::io_context>> contexts_;
+  std::vector<asio::executor_work_guard<asio::io_context::executor_type>>
+      guards_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_context_ = 0;
+};
+}
@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+#include "Common.h"
+#include "Metrics.h"
+
+namespace net {
+// Память для обработчиков ASIO одного соединения: несколько блоков
+// фиксированного размера, которые переходят от операции к операции. ASIO
+// освобождает память операции ещё до вызова её обработчика, поэтому в
+// установившемся режиме блоков хватает и куча не трогается. Выделять и
+// освобождать можно из любых потоков: Send зовут откуда угодно, а
+// освобождает поток ASIO context. Send из других потоков ставят в strand
+// не больше одного обработчика на пачку, так что одновременно заняты
+// чтение, запись и этот обработчик. Если все блоки всё же заняты или
+// операция не влезает в блок, память берётся из кучи, это видно по
+// счётчику handler_heap_allocations. Память живёт в
+// shared_ptr: аллокатор есть у каждой операции, в том числе у служебных
+// операций strand, которые не держат соединение, и при остановке
+// io_context последняя из них освобождает память после себя
+class HandlerMemory {
+ public:
+  static constexpr size_t BLOCKS = 4;
+  static constexpr size_t BLOCK_SIZE = 1024;
+
+ public:
+  HandlerMemory() = default;
+  HandlerMemory(const HandlerMemory&) = delete;
+  HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+  void* Allocate(size_t size) {
+    Metrics::Add(Metrics::counter::handler_allocations);
+    if (size <= BLOCK_SIZE) {
+      for (auto& block : blocks_) {
+        if (!block.used.load(std::memory_order_relaxed) &&
+            !block.used.exchange(true, std::memory_order_acquire)) {
+          return block.storage;
+        }
+      }
+    }
+    Metrics::Add(Metrics::counter::handler_heap_allocations);
+    return ::operator new(size);
+  }
+
+  void Deallocate(void* pointer) {
+    for (auto& block : blocks_) {
+      if (pointer == block.storage) {
+        block.used.store(false, std::memory_order_release);
+        return;
+      }
+    }
+    ::operator delete(pointer);
+  }
+
+ private:
+  struct Block {
+    alignas(std::max_align_t) unsigned char storage[BLOCK_SIZE];
+    std::atomic<bool> used = false;
+  };
+
+  Block blocks_[BLOCKS];
+};
+
+template <typename T>
+class HandlerAllocator {
+ public:
+  using value_type = T;
+
+  explicit HandlerAllocator(std::shared_ptr<HandlerMemory> memory) noexcept
+      : memory_(std::move(memory)) {}
+
+  template <typename U>
+  HandlerAllocator(const HandlerAllocator<U>& other) noexcept
+      : memory_(other.memory_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(memory_->Allocate(sizeof(T) * n));
+  }
+
+  void deallocate(T* pointer, size_t) { memory_->Deallocate(pointer); }
+
+  template <typename U>
+  bool operator==(const HandlerAllocator<U>& other) const noexcept {
+    return memory_ == other.memory_;
+  }
+
+  template <typename U>
+  bool operator!=(const HandlerAllocator<U>& other) const noexcept {
+    return memory_ != other.memory_;
+  }
+
+ private:
+  template <typename>
+  friend class HandlerAllocator;
+
+  std::shared_ptr<HandlerMemory> memory_;
+};
+
+// Обработчик, память операции которого ASIO берёт из HandlerMemory: ASIO
+// находит аллокатор через allocator_type и get_allocator(), так же как
+// bind_executor сообщает ему executor
+template <typename Handler>
+class AllocatingHandler {
+ public:
+  using allocator_type = HandlerAllocator<Handler>;
+
+  AllocatingHandler(std::shared_ptr<HandlerMemory> memory, Handler handler)
+      : allocator_(std::move(memory)), handler_(std::move(handler)) {}
+
+  allocator_type get_allocator() const noexcept { return allocator_; }
+
+  template <typename... Args>
+  void operator()(Args&&... args) {
+    handler_(std::forward<Args>(args)...);
+  }
+
+ private:
+  allocator_type allocator_;
+  Handler handler_;
+};
+
+template <typename Handler>
+AllocatingHandler<std::decay_t<Handler>> BindHandlerMemory(
+    const std::shared_ptr<HandlerMemory>& memory, Handler&& handler) {
+  return {memory, std::forward<Handler>(handler)};
+}
+}
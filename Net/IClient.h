@@ -2,26 +2,59 @@
 #include "Common.h"
 
 namespace net {
-template <typename T>
+// Transport - один из транспортов из Transport.h, по умолчанию TCP
+template <typename T, typename Transport = transport::Tcp>
 class IClient {
+ public:
+  // queue - сообщения складываются в Incoming(), откуда их забирает
+  // пользователь, callback - вызывается OnMessage прямо в потоке ASIO
+  // context, без очереди и без отдельного потока разбора
+  enum class dispatch { queue, callback };
+
  public:
   IClient() {}
 
+  // В режиме callback поток ASIO context вызывает виртуальные методы
+  // наследника, поэтому такой наследник обязан вызвать Disconnect() в своём
+  // деструкторе: здесь его часть объекта уже уничтожена. Повторный
+  // Disconnect() ничего не делает
   virtual ~IClient() {
     // Если клиент уничтожается, отключаемся от сервера
     Disconnect();
   }
 
  public:
-  bool Connect(const std::string& host, const uint16_t port) {
+  // Подключение по TCP к имени хоста и порту
+  bool Connect(const std::string& host, const uint16_t port)
+    requires std::is_same_v<Transport, transport::Tcp>
+  {
     try {
       asio::ip::tcp::resolver resolver(context_);
-      asio::ip::tcp::resolver::results_type endpoints =
-          resolver.resolve(host, std::to_string(port));
+      return Connect(resolver.resolve(host, std::to_string(port)));
+    } catch (std::exception& e) {
+      std::cerr << "Client Exception: " << e.what() << "\n";
+      return false;
+    }
+  }
 
-      connection_ = std::make_unique<Connection<T>>(
-          Connection<T>::owner::client, context_,
-          asio::ip::tcp::socket(context_), messages_in_);
+  // endpoints - адрес транспорта (для Unix domain socket - путь, для
+  // loopback - имя сервера) или, для TCP, результат resolve
+  template <typename Endpoints>
+  bool Connect(const Endpoints& endpoints) {
+    try {
+      connection_ = std::make_shared<Connection<T, Transport>>(
+          Connection<T, Transport>::owner::client, context_,
+          typename Transport::Socket(context_), messages_in_);
+      if (dispatch_ == dispatch::callback) {
+        connection_->SetMessageHandler(
+            [this](OwnedMessage<T, Transport>& message) {
+              if (message.disconnected) {
+                OnDisconnect();
+              } else {
+                OnMessage(message.message);
+              }
+            });
+      }
 
       connection_->ConnectToServer(endpoints);
 
@@ -44,7 +77,7 @@ class IClient {
     // и потока
     if (context_thread_.joinable()) context_thread_.join();
 
-    connection_.release();
+    connection_.reset();
   }
 
   bool IsConnected() {
@@ -56,8 +89,19 @@ class IClient {
     if (IsConnected()) connection_->Send(message);
   }
 
-  // Получение очереди сообщений с сервера
-  TSDeque<OwnedMessage<T>>& Incoming() { return messages_in_; }
+  // Получение очереди сообщений с сервера. Последним в неё приходит
+  // уведомление об отключении (OwnedMessage::disconnected), так что ждать
+  // сообщений можно через Wait() без опроса IsConnected()
+  IncomingQueue<OwnedMessage<T, Transport>>& Incoming() { return messages_in_; }
+
+  // Вызывать до Connect()
+  void SetDispatch(dispatch mode) { dispatch_ = mode; }
+
+ protected:
+  // В режиме callback вызываются в потоке ASIO context: долго блокировать
+  // их нельзя, иначе встанет приём и отправка
+  virtual void OnMessage(Message<T>& message) {}
+  virtual void OnDisconnect() {}
 
  protected:
   // ASIO context обрабатывает передачу данных
@@ -66,10 +110,11 @@ class IClient {
   std::thread context_thread_;
   // У клиента есть единственный экземпляр Connection<T>, который
   // обрабатывает передачу данных
-  std::unique_ptr<Connection<T>> connection_;
+  std::shared_ptr<Connection<T, Transport>> connection_;
+  dispatch dispatch_ = dispatch::queue;
 
  private:
   // Это потокобезопасный дек входящих сообщений от сервера
-  TSDeque<OwnedMessage<T>> messages_in_;
+  IncomingQueue<OwnedMessage<T, Transport>> messages_in_;
 };
 }
\ No newline at end of file
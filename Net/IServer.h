@@ -2,74 +2,160 @@
 
 #include "Common.h"
 #include "Connection.h"
+#include "ContextPool.h"
+#include "Log.h"
 #include "Message.h"
+#include "Metrics.h"
+#include "MPSCQueue.h"
+#include "SlotMap.h"
 #include "TSDeque.h"
 
 namespace net {
-template <typename T>
+// Transport - один из транспортов из Transport.h, по умолчанию TCP
+template <typename T, typename Transport = transport::Tcp>
 class IServer {
  public:
-  // Создаёт сервер
-  IServer(uint16_t port)
-      : acceptor_(context_,
-                       asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)) {}
+  // queue - сообщения приходят в OnMessage через очередь: её разбирают
+  // Update() или потоки-обработчики, session - каждого клиента целиком
+  // обслуживает своя корутина OnClientSession в strand его соединения,
+  // сообщения попадают к ней прямо из чтения, без очередей и смены потока
+  enum class dispatch { queue, session };
 
+  // Соединение с клиентом на транспорте сервера
+  using ClientConnection = Connection<T, Transport>;
+
+  // Корутина сессии, выполняется в strand соединения
+  using Session = typename ClientConnection::template Awaitable<void>;
+
+  struct Stats {
+    // Метрики всего процесса, см. Metrics
+    Metrics::Snapshot metrics;
+    size_t connections = 0;
+    // Счётчики живых соединений по их ID
+    std::vector<std::pair<uint32_t, typename ClientConnection::Stats>>
+        per_connection;
+  };
+
+ public:
+  // Создаёт сервер на адресе транспорта, threads потоков ввода-вывода
+  // обслуживают соединения
+  IServer(const typename Transport::Endpoint& endpoint, size_t threads = 1,
+          ContextPool::mode pool_mode = ContextPool::mode::shared)
+      : pool_(threads, pool_mode),
+        acceptor_(Transport::Listen(pool_.Main(), endpoint)) {}
+
+  // TCP-сервер на всех адресах IPv4
+  IServer(uint16_t port, size_t threads = 1,
+          ContextPool::mode pool_mode = ContextPool::mode::shared)
+    requires std::is_same_v<Transport, transport::Tcp>
+      : IServer(asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port), threads,
+                pool_mode) {}
+
+  // Потоки ввода-вывода и обработчики вызывают виртуальные методы
+  // наследника, поэтому наследник обязан вызвать Stop() в своём деструкторе:
+  // здесь его часть объекта уже уничтожена. Повторный Stop() ничего не
+  // делает
   virtual ~IServer() { Stop(); }
 
-  bool Start() {
+  // workers > 0 включает шардированную обработку: сообщения соединения
+  // уходят в очередь потока-обработчика с номером ID % workers, и OnMessage
+  // вызывается в нём. Порядок сообщений одного клиента сохраняется, а разные
+  // клиенты обрабатываются параллельно. При workers == 0 сообщения, как и
+  // раньше, разбирает Update()
+  bool Start(size_t workers = 0) {
     try {
+      if (dispatch_ == dispatch::queue) StartWorkers(workers);
       WaitForClientConnection();
 
-      context_thread_ = std::thread([this]() { context_.run(); });
+      pool_.Run();
     } catch (std::exception& e) {
-      std::cerr << "[Server] Exception: " << e.what() << "\n";
+      Log::Error("[Server] Exception: {}", e.what());
       return false;
     }
 
-    std::cout << "[Server] Started!\n";
+    Log::Info("[Server] Started!");
     return true;
   }
 
+  // Вызывать до Start(). В режиме session потоки-обработчики не нужны, и
+  // workers в Start() не учитывается
+  void SetDispatch(dispatch mode) { dispatch_ = mode; }
+
   void Stop() {
-    context_.stop();
-    if (context_thread_.joinable()) context_thread_.join();
-    std::cout << "[Server] Stopped!\n";
+    if (stopped_.exchange(true)) return;
+    metrics_dump_.Stop();
+    pool_.Stop();
+    StopWorkers();
+    // Сокеты и strand'ы соединений должны быть уничтожены раньше, чем
+    // context'ы пула, к которым они привязаны
+    messages_in_.Clear();
+    {
+      std::scoped_lock lock(connections_mutex_);
+      connections_.Clear();
+    }
+    Log::Info("[Server] Stopped!");
   }
 
   void WaitForClientConnection() {
+    // Сокет нового соединения сразу создаём в context из пула
+    asio::io_context& context = pool_.Next();
+
     // Ожидая, принимаем входящее соедение
-    acceptor_.async_accept([this](std::error_code ec,
-                                       asio::ip::tcp::socket socket) {
+    acceptor_.async_accept(context, [this, &context](
+                                        std::error_code ec,
+                                        typename Transport::Socket socket) {
       // Просыпаемся, когда оно пришло и обрабатываем...
       if (!ec) {
-        std::cout << "[Server] New Connection: " << socket.remote_endpoint()
-                  << "\n";
+        Log::Info("[Server] New Connection: {}", Transport::Peer(socket));
+
+        // ID соединения - handle его ячейки в таблице соединений. От ID
+        // зависит очередь обработчика, поэтому ячейку занимаем заранее
+        uint32_t id = SlotMap<std::shared_ptr<ClientConnection>>::NULL_HANDLE;
+        {
+          std::scoped_lock lock(connections_mutex_);
+          id = connections_.Insert(nullptr);
+        }
+        if (id == SlotMap<std::shared_ptr<ClientConnection>>::NULL_HANDLE) {
+          Log::Warning("[-----] Connection Denied: too many connections");
+          WaitForClientConnection();
+          return;
+        }
 
         // Создаём соединение (сокет) для общения с клиентом,
         // умный указатель, необходим для того, чтобы если соединение
         // будет без ожидающих задач, то он удалит объект Connection
-        std::shared_ptr<Connection<T>> newconn =
-            std::make_shared<Connection<T>>(Connection<T>::owner::server,
-                                            context_, std::move(socket),
-                                            messages_in_);
+        std::shared_ptr<ClientConnection> newconn =
+            std::make_shared<ClientConnection>(ClientConnection::owner::server,
+                                               context, std::move(socket),
+                                               ShardQueue(id));
 
         // Можем отменить соедение, по умолчанию нет
         if (OnClientConnect(newconn)) {
-          connections_.push_back(std::move(newconn));
+          {
+            std::scoped_lock lock(connections_mutex_);
+            *connections_.Find(id) = newconn;
+          }
 
+          if (dispatch_ == dispatch::session) {
+            newconn->EnableSession();
+            asio::co_spawn(newconn->GetStrand(), RunSession(newconn),
+                           asio::detached);
+          }
           // У соединения выдаём задание по чтению байтов его ASIO context
-          connections_.back()->ConnectToClient(id_counter_++);
+          newconn->ConnectToClient(id);
 
-          std::cout << "[" << connections_.back()->GetID()
-                    << "] Connection Approved\n";
+          Metrics::Add(Metrics::counter::connections_accepted);
+          Log::Info("[{}] Connection Approved", id);
         } else {
-          std::cout << "[-----] Connection Denied\n";
+          Log::Info("[-----] Connection Denied");
 
           // А соединение без области видимости и ожидающих задач будет
           // уничтожено
+          std::scoped_lock lock(connections_mutex_);
+          connections_.Erase(id);
         }
       } else {
-        std::cout << "[SERVER] New Connection Error: " << ec.message() << "\n";
+        Log::Warning("[SERVER] New Connection Error: {}", ec);
       }
 
       // Обрабатываем следующее соединение
@@ -77,43 +163,220 @@ class IServer {
     });
   }
 
+  // Рассылает одно сообщение набору соединений, тело при этом не копируется
+  template <typename Connections>
+  void Broadcast(const SharedMessage<T>& message, const Connections& clients) {
+    for (auto& client : clients) {
+      if (client && client->IsConnected()) {
+        client->Send(message);
+      }
+    }
+  }
+
+  // В шардированном режиме messages_in_ всегда пуст, и с bWait == true
+  // Update() просто усыпляет вызывающий поток
   void Update(size_t nMaxMessages = -1, bool bWait = false) {
     if (bWait) {
       messages_in_.Wait();
     }
 
-    size_t nMessageCount = 0;
-    while (nMessageCount < nMaxMessages && !messages_in_.Empty()) {
-      auto message = messages_in_.PopFront();
+    // Забираем все ожидающие сообщения разом, а не по одному
+    messages_in_.DrainInto(batch_, nMaxMessages);
+    for (auto& message : batch_) {
+      Dispatch(message);
+    }
+    batch_.clear();
+  }
+
+  // Число живых соединений в таблице
+  size_t ConnectionsCount() {
+    std::scoped_lock lock(connections_mutex_);
+    return connections_.Size();
+  }
+
+  // Снимок метрик. Счётчики по соединениям собираются под блокировкой
+  // таблицы соединений, поэтому при множестве клиентов их лучше не
+  // запрашивать слишком часто
+  Stats GetStats(bool per_connection = false) {
+    Stats stats;
+    stats.metrics = Metrics::GetSnapshot();
+    std::scoped_lock lock(connections_mutex_);
+    stats.connections = connections_.Size();
+    if (per_connection) {
+      connections_.ForEach([&](auto& connection) {
+        if (connection) {
+          stats.per_connection.emplace_back(connection->GetID(),
+                                            connection->GetStats());
+        }
+      });
+    }
+    return stats;
+  }
+
+  // Раз в interval печатает строку: число соединений, глубину очередей
+  // входящих и исходящих сообщений, скорости и перцентили задержек за
+  // прошедший интервал
+  void StartMetricsDump(std::chrono::milliseconds interval) {
+    metrics_dump_.Start(interval, [this](const Metrics::Snapshot& total,
+                                         const Metrics::Snapshot& delta,
+                                         double seconds) {
+      using counter = Metrics::counter;
+      // Шарды складываются не одновременно, и разность может ненадолго
+      // уйти в минус
+      auto depth = [](uint64_t in, uint64_t out) {
+        return in > out ? in - out : 0;
+      };
+      uint64_t incoming = depth(total.Get(counter::incoming_pushed),
+                                total.Get(counter::incoming_dispatched));
+      uint64_t outgoing =
+          depth(total.Get(counter::messages_queued),
+                total.Get(counter::messages_out) +
+                    total.Get(counter::messages_dropped));
+      std::cout << "[Metrics] connections " << ConnectionsCount()
+                << ", incoming queue " << incoming << ", outgoing queue "
+                << outgoing << "," << Metrics::Format(delta, seconds) << "\n";
+    });
+  }
+
+ private:
+  // Уведомление об отключении приходит после всех сообщений соединения и
+  // в тот же поток, поэтому OnClientDisconnect может без блокировок
+  // освобождать всё, что связано с клиентом
+  void Dispatch(OwnedMessage<T, Transport>& message) {
+    Metrics::Add(Metrics::counter::incoming_dispatched);
+    if (!message.disconnected) {
+      auto now = Metrics::Clock::now();
+      Metrics::Record(Metrics::histogram::receive_to_handle,
+                      now - message.received);
+      // Всё, что OnMessage отправит, считается от этого момента
+      Metrics::HandlingScope handling(now);
       OnMessage(message.remote, message.message);
+      return;
+    }
+
+    Close(message.remote);
+  }
+
+  // Сессия может закончиться раньше соединения, тогда оно закрывается.
+  // OnClientDisconnect вызывается, только когда чтение уже остановилось,
+  // и в том же strand, как и вся сессия
+  Session RunSession(std::shared_ptr<ClientConnection> client) {
+    try {
+      co_await OnClientSession(client);
+    } catch (std::exception& e) {
+      Log::Error("[{}] Session Exception: {}", client->GetID(), e.what());
+    }
+    client->Disconnect();
+    while (co_await client->Receive()) {
+    }
+    Close(client);
+  }
+
+  void Close(const std::shared_ptr<ClientConnection>& client) {
+    Metrics::Add(Metrics::counter::connections_closed);
+    OnClientDisconnect(client);
+
+    // Ссылку отпускаем уже без блокировки. Само соединение уничтожится,
+    // когда завершатся его последние обработчики
+    std::optional<std::shared_ptr<ClientConnection>> connection;
+    {
+      std::scoped_lock lock(connections_mutex_);
+      connection = connections_.Extract(client->GetID());
+    }
+  }
+
+  // Очередь, в которую будет складывать сообщения соединение с этим ID
+  IncomingQueue<OwnedMessage<T, Transport>>& ShardQueue(uint32_t id) {
+    if (shards_.empty()) return messages_in_;
+    return shards_[id % shards_.size()]->messages_in;
+  }
+
+  void StartWorkers(size_t workers) {
+    if (!shards_.empty()) return;
+
+    for (size_t i = 0; i < workers; ++i) {
+      shards_.push_back(std::make_unique<Shard>());
+    }
+    for (auto& shard : shards_) {
+      shard->running = true;
+      shard->thread = std::thread([this, &shard = *shard]() {
+        std::vector<OwnedMessage<T, Transport>> batch;
+        while (shard.running) {
+          shard.messages_in.Wait();
+          shard.messages_in.DrainInto(batch);
+          for (auto& message : batch) {
+            // Пустое сообщение без отправителя только будит поток при Stop()
+            if (message.remote) {
+              Dispatch(message);
+            }
+          }
+          batch.clear();
+        }
+      });
+    }
+  }
 
-      nMessageCount++;
+  void StopWorkers() {
+    for (auto& shard : shards_) {
+      shard->running = false;
+      shard->messages_in.PushBack({});
     }
+    for (auto& shard : shards_) {
+      if (shard->thread.joinable()) shard->thread.join();
+    }
+    shards_.clear();
   }
 
  protected:
 
-  virtual bool OnClientConnect(std::shared_ptr<Connection<T>> client) {
+  virtual bool OnClientConnect(std::shared_ptr<ClientConnection> client) {
     return false;
   }
 
-  virtual void OnClientDisconnect(std::shared_ptr<Connection<T>> client) {}
+  virtual void OnClientDisconnect(std::shared_ptr<ClientConnection> client) {}
 
-  virtual void OnMessage(std::shared_ptr<Connection<T>> client,
+  virtual void OnMessage(std::shared_ptr<ClientConnection> client,
                          Message<T>& message) {}
 
+  // Сессия клиента в режиме dispatch::session. По умолчанию просто
+  // передаёт сообщения в OnMessage, но может вести всю партию сама:
+  // ждать ходов через co_await client->Receive() и отвечать через
+  // co_await client->AsyncSend(message)
+  virtual Session OnClientSession(
+      std::shared_ptr<ClientConnection> client) {
+    while (auto message = co_await client->Receive()) {
+      OnMessage(client, *message);
+    }
+  }
+
  protected:
-  TSDeque<OwnedMessage<T>> messages_in_;
+  IncomingQueue<OwnedMessage<T, Transport>> messages_in_;
+  // Переиспользуемый буфер для пакетной выборки в Update()
+  std::vector<OwnedMessage<T, Transport>> batch_;
 
-  std::deque<std::shared_ptr<Connection<T>>> connections_;
+  // Живые соединения по ID. Ячейки отключившихся клиентов
+  // переиспользуются, их старые ID больше ничего не находят
+  SlotMap<std::shared_ptr<ClientConnection>> connections_;
+  std::mutex connections_mutex_;
+
+  // Поток-обработчик игровой логики со своей очередью входящих сообщений
+  struct Shard {
+    IncomingQueue<OwnedMessage<T, Transport>> messages_in;
+    std::thread thread;
+    std::atomic<bool> running = false;
+  };
+  std::vector<std::unique_ptr<Shard>> shards_;
+  dispatch dispatch_ = dispatch::queue;
+  // Деструкторы наследника и IServer оба вызывают Stop(), остановка
+  // выполняется один раз
+  std::atomic<bool> stopped_ = false;
+
+  MetricsDump metrics_dump_;
 
   // Порядок объявления и инициализации важен!
-  asio::io_context context_;
-  std::thread context_thread_;
+  ContextPool pool_;
 
   // Будет выполнять ASIO context
-  asio::ip::tcp::acceptor acceptor_;
-
-  uint32_t id_counter_ = 0;
+  typename Transport::Acceptor acceptor_;
 };
 }
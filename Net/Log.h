@@ -0,0 +1,528 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include "Common.h"
+
+namespace net {
+// Асинхронный лог. Вызов Log::Info(...) не форматирует текст и ничего не
+// выделяет: он кладёт запись фиксированного размера (время, указатель на
+// строку формата и аргументы в двоичном виде) в кольцевой буфер своего
+// потока. Фоновый поток забирает записи из буферов всех потоков,
+// подставляет аргументы вместо "{}" и пишет строки в файл. Если буфер
+// потока полон, запись выбрасывается, а не ждёт. Каждая строка формата
+// ограничена по частоте: сверх SetRateLimit записей в секунду записи
+// пропускаются, а следующая прошедшая сообщает, сколько их было
+class Log {
+ public:
+  enum class level : uint8_t { debug, info, warning, error, off };
+
+  static constexpr size_t RECORD_SIZE = 128;
+  static constexpr size_t RING_RECORDS = 1024;
+  static constexpr size_t MAX_ARGS = 8;
+
+  struct Stats {
+    uint64_t written = 0;
+    // Буфер потока был полон
+    uint64_t dropped = 0;
+    // Отброшено ограничением частоты
+    uint64_t suppressed = 0;
+  };
+
+ public:
+  template <typename... Args>
+  static void Debug(const char* format, const Args&... args) {
+    Write(level::debug, format, args...);
+  }
+
+  template <typename... Args>
+  static void Info(const char* format, const Args&... args) {
+    Write(level::info, format, args...);
+  }
+
+  template <typename... Args>
+  static void Warning(const char* format, const Args&... args) {
+    Write(level::warning, format, args...);
+  }
+
+  template <typename... Args>
+  static void Error(const char* format, const Args&... args) {
+    Write(level::error, format, args...);
+  }
+
+  // format должен жить всю программу, обычно это строковый литерал.
+  // Аргументы: целые, числа с плавающей точкой, строки (копируются и при
+  // нехватке места обрезаются), tcp::endpoint и error_code
+  template <typename... Args>
+  static void Write(level lvl, const char* format, const Args&... args) {
+    static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+    if (!Enabled(lvl)) return;
+
+    auto now = std::chrono::system_clock::now();
+    uint32_t suppressed = 0;
+    if (!Allow(format, now, suppressed)) return;
+
+    Ring* ring = Local();
+    if (ring == nullptr) return;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == RING_RECORDS) {
+      ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+      return;
+    }
+
+    Record& record = ring->records[head % RING_RECORDS];
+    record.time = now;
+    record.format = format;
+    record.suppressed = suppressed;
+    record.lvl = lvl;
+    record.count = 0;
+    if constexpr (sizeof...(Args) > 0) {
+      size_t used = 0;
+      (Encode(record, used, args), ...);
+    }
+    ring->head.store(head + 1, std::memory_order_release);
+  }
+
+  static bool Enabled(level lvl) {
+    return lvl >= GetState().min_level.load(std::memory_order_relaxed);
+  }
+
+  static void SetLevel(level lvl) {
+    GetState().min_level.store(lvl, std::memory_order_relaxed);
+  }
+
+  // Записей в секунду с одной строки формата, 0 - без ограничения
+  static void SetRateLimit(uint32_t per_second) {
+    GetState().rate_limit.store(per_second, std::memory_order_relaxed);
+  }
+
+  // По умолчанию stdout. После возврата в прежний файл уже ничего не
+  // пишется, и его можно закрыть
+  static void SetOutput(std::FILE* file) {
+    State& state = GetState();
+    std::scoped_lock lock(state.output_mutex);
+    state.output = file;
+  }
+
+  // Ждёт, пока фоновый поток выведет всё, что записано до вызова
+  static void Flush() {
+    State& state = GetState();
+    std::unique_lock lock(state.mutex);
+    if (!state.thread.joinable()) return;
+    uint64_t target = ++state.flush_requested;
+    state.wake.notify_one();
+    state.flushed_cv.wait(lock,
+                          [&]() { return state.flushed >= target; });
+  }
+
+  static Stats GetStats() {
+    State& state = GetState();
+    std::scoped_lock lock(state.mutex);
+    Stats stats;
+    stats.written = state.written;
+    stats.dropped = state.retired_dropped;
+    for (auto& ring : state.rings) {
+      stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    stats.suppressed = state.suppressed.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  enum class kind : uint8_t { none, int64, uint64, float64, string, endpoint,
+                              error };
+
+  struct Record {
+    std::chrono::system_clock::time_point time;
+    const char* format = nullptr;
+    // Сколько записей с этой строкой формата отбросило ограничение частоты
+    // перед этой
+    uint32_t suppressed = 0;
+    level lvl = level::info;
+    uint8_t count = 0;
+    kind kinds[MAX_ARGS] = {};
+    uint8_t payload[RECORD_SIZE - 32];
+  };
+  static_assert(sizeof(Record) == RECORD_SIZE);
+
+  // Один писатель (свой поток) и один читатель (фоновый поток)
+  struct Ring {
+    Record records[RING_RECORDS];
+    alignas(64) std::atomic<uint64_t> head = 0;
+    alignas(64) std::atomic<uint64_t> tail = 0;
+    std::atomic<uint64_t> dropped = 0;
+    // Поток завершился: кольцо освобождается, как только опустеет
+    std::atomic<bool> abandoned = false;
+  };
+
+  // Ограничение частоты по строке формата. Места вызова различаются по
+  // адресу строки, совпадения по хешу просто делят общий лимит
+  struct Site {
+    // Старшие 32 бита - секунда, младшие - число записей в ней
+    std::atomic<uint64_t> window = 0;
+    std::atomic<uint32_t> suppressed = 0;
+  };
+  static constexpr size_t SITES = 256;
+
+  struct State {
+    State() : thread([this]() { Run(); }) {}
+
+    ~State() {
+      {
+        std::scoped_lock lock(mutex);
+        stop = true;
+      }
+      wake.notify_one();
+      if (thread.joinable()) thread.join();
+    }
+
+    void Run() {
+      std::unique_lock lock(mutex);
+      while (true) {
+        uint64_t requested = flush_requested;
+        bool stopping = stop;
+        size_t drained = Drain(lock);
+        if (flushed < requested) {
+          flushed = requested;
+          flushed_cv.notify_all();
+        }
+        if (stopping) return;
+        if (drained == 0) {
+          wake.wait_for(lock, std::chrono::milliseconds(10));
+        }
+      }
+    }
+
+    // Вызывается под mutex. Разбор и вывод идут без него, чтобы поток,
+    // впервые пишущий в журнал, не ждал диска: под mutex только
+    // копируется список колец. Удаляет кольца только этот поток, так что
+    // скопированные указатели остаются живыми
+    size_t Drain(std::unique_lock<std::mutex>& lock) {
+      draining.clear();
+      for (auto& ring : rings) draining.push_back(ring.get());
+      lock.unlock();
+
+      size_t drained = 0;
+      retiring.clear();
+      for (Ring* ring : draining) {
+        bool abandoned = ring->abandoned.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        drained += head - tail;
+        for (; tail != head; ++tail) {
+          Format(ring->records[tail % RING_RECORDS], line);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        if (abandoned) retiring.push_back(ring);
+      }
+      if (!line.empty()) {
+        std::scoped_lock output_lock(output_mutex);
+        std::fwrite(line.data(), 1, line.size(), output);
+        std::fflush(output);
+        line.clear();
+      }
+
+      lock.lock();
+      written += drained;
+      for (Ring* ring : retiring) {
+        retired_dropped += ring->dropped.load(std::memory_order_relaxed);
+        std::erase_if(rings, [ring](const auto& owned) {
+          return owned.get() == ring;
+        });
+      }
+      return drained;
+    }
+
+    void Format(const Record& record, std::string& out) {
+      AppendTime(record.time, out);
+      static const char LEVELS[] = "DIWE";
+      out += ' ';
+      out += LEVELS[static_cast<int>(record.lvl)];
+      out += ' ';
+
+      size_t arg = 0;
+      size_t used = 0;
+      for (const char* c = record.format; *c; ++c) {
+        if (c[0] == '{' && c[1] == '}' && arg < record.count) {
+          AppendArg(record, record.kinds[arg++], used, out);
+          ++c;
+        } else {
+          out += *c;
+        }
+      }
+      if (record.suppressed > 0) {
+        out += " (";
+        out += std::to_string(record.suppressed);
+        out += " similar suppressed)";
+      }
+      out += '\n';
+    }
+
+    std::atomic<level> min_level = level::info;
+    std::atomic<uint32_t> rate_limit = 100;
+    Site sites[SITES];
+    std::atomic<uint64_t> suppressed = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable flushed_cv;
+    std::vector<std::unique_ptr<Ring>> rings;
+    // Поток вывода держит его на время записи в файл
+    std::mutex output_mutex;
+    std::FILE* output = stdout;
+    // Дальше только для потока вывода
+    std::vector<Ring*> draining;
+    std::vector<Ring*> retiring;
+    std::string line;
+    uint64_t written = 0;
+    uint64_t retired_dropped = 0;
+    uint64_t flush_requested = 0;
+    uint64_t flushed = 0;
+    bool stop = false;
+    // Последним: поток стартует, когда всё остальное уже создано
+    std::thread thread;
+  };
+
+  // Без деструктора, поэтому доступна потоку до самого конца
+  struct LocalRing {
+    Ring* ring = nullptr;
+    bool retired = false;
+  };
+
+  // Поток отдаёт своё кольцо фоновому потоку при завершении
+  struct RingOwner {
+    ~RingOwner() {
+      LocalRing& local = GetLocal();
+      if (local.ring) {
+        local.ring->abandoned.store(true, std::memory_order_release);
+      }
+      local.ring = nullptr;
+      local.retired = true;
+    }
+  };
+
+  static State& GetState() {
+    static State state;
+    return state;
+  }
+
+  static LocalRing& GetLocal() {
+    thread_local LocalRing local;
+    return local;
+  }
+
+  // Кольцо создаётся при первой записи потока, дальше запись идёт без
+  // блокировок и выделения памяти. nullptr в деструкторах статических
+  // объектов, когда thread_local уже разрушены
+  static Ring* Local() {
+    LocalRing& local = GetLocal();
+    if (local.ring == nullptr && !local.retired) {
+      thread_local RingOwner owner;
+      State& state = GetState();
+      std::scoped_lock lock(state.mutex);
+      state.rings.push_back(std::make_unique<Ring>());
+      local.ring = state.rings.back().get();
+    }
+    return local.ring;
+  }
+
+  static bool Allow(const char* format,
+                    std::chrono::system_clock::time_point now,
+                    uint32_t& suppressed) {
+    State& state = GetState();
+    uint32_t limit = state.rate_limit.load(std::memory_order_relaxed);
+    if (limit == 0) return true;
+
+    Site& site = state.sites[(reinterpret_cast<uintptr_t>(format) >> 3) %
+                             SITES];
+    uint64_t second = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(
+            now.time_since_epoch())
+            .count());
+    uint64_t window = site.window.load(std::memory_order_relaxed);
+    while (true) {
+      uint64_t next = 0;
+      if ((window >> 32) != (second & 0xffffffff)) {
+        next = (second << 32) | 1;
+      } else if ((window & 0xffffffff) < limit) {
+        next = window + 1;
+      } else {
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        state.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      if (site.window.compare_exchange_weak(window, next,
+                                            std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    if (site.suppressed.load(std::memory_order_relaxed) > 0) {
+      suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  static bool Fits(const Record& record, size_t used, size_t size) {
+    return used + size <= sizeof(record.payload);
+  }
+
+  template <typename Value>
+  static void Put(Record& record, size_t& used, kind k, const Value& value) {
+    if (!Fits(record, used, sizeof(value))) {
+      record.kinds[record.count++] = kind::none;
+      return;
+    }
+    std::memcpy(record.payload + used, &value, sizeof(value));
+    used += sizeof(value);
+    record.kinds[record.count++] = k;
+  }
+
+  template <typename Value>
+  static Value Get(const Record& record, size_t& used) {
+    Value value;
+    std::memcpy(&value, record.payload + used, sizeof(value));
+    used += sizeof(value);
+    return value;
+  }
+
+  template <typename Arg>
+  static void Encode(Record& record, size_t& used, const Arg& arg) {
+    if constexpr (std::is_same_v<Arg, bool>) {
+      Put(record, used, kind::uint64, static_cast<uint64_t>(arg));
+    } else if constexpr (std::is_enum_v<Arg>) {
+      Encode(record, used, static_cast<std::underlying_type_t<Arg>>(arg));
+    } else if constexpr (std::is_integral_v<Arg> && std::is_signed_v<Arg>) {
+      Put(record, used, kind::int64, static_cast<int64_t>(arg));
+    } else if constexpr (std::is_integral_v<Arg>) {
+      Put(record, used, kind::uint64, static_cast<uint64_t>(arg));
+    } else if constexpr (std::is_floating_point_v<Arg>) {
+      Put(record, used, kind::float64, static_cast<double>(arg));
+    } else if constexpr (std::is_convertible_v<const Arg&, std::string_view>) {
+      // Длина в одном байте, затем сами символы, сколько поместится
+      std::string_view text = arg;
+      if (!Fits(record, used, 1)) {
+        record.kinds[record.count++] = kind::none;
+        return;
+      }
+      size_t length = std::min({text.size(), size_t{255},
+                                sizeof(record.payload) - used - 1});
+      record.payload[used] = static_cast<uint8_t>(length);
+      std::memcpy(record.payload + used + 1, text.data(), length);
+      used += 1 + length;
+      record.kinds[record.count++] = kind::string;
+    } else if constexpr (std::is_same_v<Arg, asio::ip::tcp::endpoint>) {
+      // Адрес хранится байтами (IPv4 как IPv6 с префиксом ::ffff:)
+      struct {
+        asio::ip::address_v6::bytes_type bytes;
+        uint16_t port;
+        bool v4;
+      } endpoint{};
+      asio::ip::address address = arg.address();
+      endpoint.v4 = address.is_v4();
+      endpoint.bytes =
+          endpoint.v4 ? asio::ip::make_address_v6(asio::ip::v4_mapped,
+                                                  address.to_v4())
+                            .to_bytes()
+                      : address.to_v6().to_bytes();
+      endpoint.port = arg.port();
+      Put(record, used, kind::endpoint, endpoint);
+    } else if constexpr (std::is_convertible_v<const Arg&, std::error_code>) {
+      // Категории ошибок - статические объекты, указатель на них
+      // действителен всю программу
+      std::error_code code = arg;
+      struct {
+        const std::error_category* category;
+        int value;
+      } error{&code.category(), code.value()};
+      Put(record, used, kind::error, error);
+    } else {
+      static_assert(!sizeof(Arg), "unsupported log argument");
+    }
+  }
+
+  static void AppendArg(const Record& record, kind k, size_t& used,
+                        std::string& out) {
+    switch (k) {
+      case kind::none:
+        out += '?';
+        break;
+
+      case kind::int64:
+        out += std::to_string(Get<int64_t>(record, used));
+        break;
+
+      case kind::uint64:
+        out += std::to_string(Get<uint64_t>(record, used));
+        break;
+
+      case kind::float64: {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%g",
+                      Get<double>(record, used));
+        out += buffer;
+      } break;
+
+      case kind::string: {
+        size_t length = record.payload[used];
+        out.append(reinterpret_cast<const char*>(record.payload + used + 1),
+                   length);
+        used += 1 + length;
+      } break;
+
+      case kind::endpoint: {
+        struct {
+          asio::ip::address_v6::bytes_type bytes;
+          uint16_t port;
+          bool v4;
+        } endpoint;
+        endpoint = Get<decltype(endpoint)>(record, used);
+        asio::ip::address_v6 address(endpoint.bytes);
+        if (endpoint.v4) {
+          out += asio::ip::make_address_v4(asio::ip::v4_mapped, address)
+                     .to_string();
+        } else {
+          out += '[' + address.to_string() + ']';
+        }
+        out += ':';
+        out += std::to_string(endpoint.port);
+      } break;
+
+      case kind::error: {
+        struct {
+          const std::error_category* category;
+          int value;
+        } error;
+        error = Get<decltype(error)>(record, used);
+        out += error.category->message(error.value);
+      } break;
+    }
+  }
+
+  static void AppendTime(std::chrono::system_clock::time_point time,
+                         std::string& out) {
+    std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  time.time_since_epoch())
+                  .count() %
+              1000;
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%02d:%02d:%02d.%03d",
+                  local.tm_hour, local.tm_min, local.tm_sec,
+                  static_cast<int>(ms));
+    out += buffer;
+  }
+};
+}
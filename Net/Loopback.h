@@ -0,0 +1,498 @@
+﻿#pragma once
+
+#include <map>
+#include <string>
+
+#include "Common.h"
+
+namespace net {
+// Адрес loopback-транспорта: имя, под которым слушает сервер этого же
+// процесса
+struct LoopbackEndpoint {
+  std::string name;
+};
+
+// Поток байтов в памяти процесса вместо сокета: по кольцевому буферу на
+// каждое направление. Повторяет ту часть интерфейса сокета ASIO, которой
+// пользуются Connection и asio::async_read/async_write, так что сообщения
+// проходят тот же путь, что и по TCP, только без ядра и сетевого стека.
+// Стороны могут жить в разных io_context, обработчики вызываются через
+// их executor'ы, как у сокета
+class LoopbackStream {
+ public:
+  using executor_type = asio::any_io_executor;
+  using endpoint_type = LoopbackEndpoint;
+
+  // Ёмкость буфера одного направления. Запись в полный буфер ждёт, пока
+  // другая сторона прочитает, как у сокета с заполненным буфером отправки
+  static constexpr size_t CAPACITY = 256 * 1024;
+
+ public:
+  explicit LoopbackStream(asio::io_context& context)
+      : executor_(context.get_executor()) {}
+
+  LoopbackStream(LoopbackStream&& other) noexcept = default;
+
+  LoopbackStream& operator=(LoopbackStream&& other) noexcept {
+    if (this != &other) {
+      close();
+      executor_ = std::move(other.executor_);
+      state_ = std::move(other.state_);
+      side_ = other.side_;
+    }
+    return *this;
+  }
+
+  ~LoopbackStream() { close(); }
+
+  executor_type get_executor() const noexcept { return executor_; }
+
+  bool is_open() const {
+    return state_ && state_->open[side_].load(std::memory_order_acquire);
+  }
+
+  // Другая сторона получит eof, когда прочитает всё уже записанное, а её
+  // запись завершится broken_pipe. Ждущие операции этой стороны
+  // завершаются operation_aborted
+  void close() {
+    if (state_) Close(*state_, side_);
+  }
+
+  // Имя сервера, к которому подключён поток
+  LoopbackEndpoint remote_endpoint() const {
+    return {state_ ? state_->name : std::string()};
+  }
+
+  // Подключение к LoopbackAcceptor с этим именем. Завершается сразу, не
+  // дожидаясь async_accept: записанное до него ждёт в буфере, как в
+  // очереди соединений TCP
+  template <typename Token>
+  auto async_connect(const LoopbackEndpoint& endpoint, Token&& token) {
+    return asio::async_initiate<Token, void(error_code)>(
+        [this](auto handler, const LoopbackEndpoint& endpoint) {
+          error_code ec = Connect(endpoint);
+          Post(executor_, std::move(handler), ec);
+        },
+        token, endpoint);
+  }
+
+  template <typename MutableBuffers, typename Token>
+  auto async_read_some(const MutableBuffers& buffers, Token&& token) {
+    return asio::async_initiate<Token, void(error_code, size_t)>(
+        [this](auto handler, const MutableBuffers& buffers) {
+          Read(buffers, std::move(handler));
+        },
+        token, buffers);
+  }
+
+  template <typename ConstBuffers, typename Token>
+  auto async_write_some(const ConstBuffers& buffers, Token&& token) {
+    return asio::async_initiate<Token, void(error_code, size_t)>(
+        [this](auto handler, const ConstBuffers& buffers) {
+          Write(buffers, std::move(handler));
+        },
+        token, buffers);
+  }
+
+ private:
+  friend class LoopbackAcceptor;
+
+  // Ждущие чтение или запись, в том числе приём соединения
+  class Operation;
+  class Accept;
+
+  // Одно направление: кольцо [begin, end) в data, его пишет одна сторона,
+  // а читает другая
+  struct Pipe {
+    std::vector<uint8_t> data;
+    size_t begin = 0;
+    size_t end = 0;
+    // Писатель закрылся: читатель получит eof, когда всё прочитает
+    bool writer_closed = false;
+    // Читатель закрылся: запись завершается broken_pipe
+    bool reader_closed = false;
+    std::unique_ptr<Operation> reader;
+    std::unique_ptr<Operation> writer;
+
+    size_t Size() const { return end - begin; }
+
+    template <typename Buffers>
+    size_t Put(const Buffers& buffers) {
+      if (data.empty()) data.resize(CAPACITY);
+      // Непрочитанное переносим в начало, только если в хвост не влезает
+      if (begin > 0 && data.size() - end < asio::buffer_size(buffers)) {
+        std::memmove(data.data(), data.data() + begin, Size());
+        end -= begin;
+        begin = 0;
+      }
+      size_t bytes = asio::buffer_copy(
+          asio::buffer(data.data() + end, data.size() - end), buffers);
+      end += bytes;
+      return bytes;
+    }
+
+    template <typename Buffers>
+    size_t Take(const Buffers& buffers) {
+      size_t bytes =
+          asio::buffer_copy(buffers, asio::buffer(data.data() + begin, Size()));
+      begin += bytes;
+      if (begin == end) begin = end = 0;
+      return bytes;
+    }
+  };
+
+  // Пара потоков. pipes[side] пишет сторона side: 0 - подключившаяся,
+  // 1 - принятая сервером
+  struct State {
+    explicit State(std::string name) : name(std::move(name)) {}
+
+    std::string name;
+    std::mutex mutex;
+    Pipe pipes[2];
+    std::atomic<bool> open[2] = {true, true};
+  };
+
+  class Operation {
+   public:
+    virtual ~Operation() = default;
+    // Под блокировкой State: переносит байты между буферами операции и
+    // кольцом
+    virtual size_t Transfer(Pipe& pipe) = 0;
+    virtual void Complete(const error_code& ec, size_t bytes) = 0;
+  };
+
+  // Держит работу executor'а обработчика, чтобы его io_context не
+  // остановился, пока другая сторона молчит
+  template <bool reading, typename Buffers, typename Handler>
+  class PendingOperation : public Operation {
+   public:
+    PendingOperation(const Buffers& buffers, Handler handler,
+                     const executor_type& fallback)
+        : buffers_(buffers),
+          handler_(std::move(handler)),
+          work_(asio::prefer(asio::get_associated_executor(handler_, fallback),
+                             asio::execution::outstanding_work.tracked)) {}
+
+    size_t Transfer(Pipe& pipe) override {
+      if constexpr (reading) {
+        return pipe.Take(buffers_);
+      } else {
+        return pipe.Put(buffers_);
+      }
+    }
+
+    void Complete(const error_code& ec, size_t bytes) override {
+      asio::post(work_, [handler = std::move(handler_), ec, bytes]() mutable {
+        handler(ec, bytes);
+      });
+    }
+
+   private:
+    Buffers buffers_;
+    Handler handler_;
+    std::decay_t<decltype(asio::prefer(
+        std::declval<asio::associated_executor_t<Handler, executor_type>>(),
+        asio::execution::outstanding_work.tracked))>
+        work_;
+  };
+
+  // Слушающий LoopbackAcceptor: подключения, которые он ещё не принял, и
+  // ждущие async_accept
+  struct Listener {
+    std::string name;
+    std::deque<std::shared_ptr<State>> backlog;
+    std::deque<std::unique_ptr<Accept>> accepts;
+    bool closed = false;
+  };
+
+  class Accept {
+   public:
+    virtual ~Accept() = default;
+    virtual void Complete(const error_code& ec,
+                          std::shared_ptr<State> state) = 0;
+  };
+
+  // При уничтожении io_context ждущие операции его потоков уничтожаются,
+  // не вызываясь, как операции сокетов. Их обработчики держат соединения,
+  // а соединения - потоки: иначе такой круг пережил бы context, и другая
+  // сторона не узнала бы об отключении
+  class Service : public asio::execution_context::service {
+   public:
+    inline static asio::execution_context::id id;
+
+    explicit Service(asio::execution_context& context)
+        : asio::execution_context::service(context) {}
+
+    void Add(const std::shared_ptr<State>& state, size_t side) {
+      std::scoped_lock lock(mutex_);
+      // Записи закрытых потоков выбрасываем, когда вектору пора расти
+      if (streams_.size() == streams_.capacity()) {
+        std::erase_if(streams_, [](const auto& stream) {
+          return stream.first.expired();
+        });
+      }
+      streams_.emplace_back(state, side);
+    }
+
+   private:
+    void shutdown() override {
+      // Обработчики уничтожаются уже без блокировок: вместе с ними
+      // уничтожаются соединения, а с ними закрываются потоки
+      std::vector<std::shared_ptr<State>> states;
+      std::vector<std::unique_ptr<Operation>> operations;
+      {
+        std::scoped_lock lock(mutex_);
+        for (auto& [weak, side] : streams_) {
+          auto state = weak.lock();
+          if (!state) continue;
+          std::scoped_lock state_lock(state->mutex);
+          operations.push_back(std::move(state->pipes[1 - side].reader));
+          operations.push_back(std::move(state->pipes[side].writer));
+          states.push_back(std::move(state));
+        }
+        streams_.clear();
+      }
+      operations.clear();
+    }
+
+    std::mutex mutex_;
+    std::vector<std::pair<std::weak_ptr<State>, size_t>> streams_;
+  };
+
+  LoopbackStream(asio::io_context& context, std::shared_ptr<State> state,
+                 size_t side)
+      : executor_(context.get_executor()), state_(std::move(state)),
+        side_(side) {
+    if (state_) asio::use_service<Service>(context).Add(state_, side_);
+  }
+
+  static std::mutex& RegistryMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  // Слушающие имена процесса, трогается под RegistryMutex()
+  static std::map<std::string, Listener*>& Registry() {
+    static std::map<std::string, Listener*> listeners;
+    return listeners;
+  }
+
+  // Обработчик нельзя вызывать из инициирующей функции, только через его
+  // executor
+  template <typename Handler, typename... Args>
+  static void Post(const executor_type& fallback, Handler handler,
+                   Args... args) {
+    auto executor = asio::get_associated_executor(handler, fallback);
+    asio::post(executor, [handler = std::move(handler), args...]() mutable {
+      handler(args...);
+    });
+  }
+
+  template <bool reading, typename Buffers, typename Handler>
+  std::unique_ptr<Operation> MakeOperation(const Buffers& buffers,
+                                           Handler handler) {
+    return std::make_unique<PendingOperation<reading, Buffers, Handler>>(
+        buffers, std::move(handler), executor_);
+  }
+
+  static void Finish(std::unique_ptr<Operation>& operation,
+                     const error_code& ec, size_t bytes = 0) {
+    if (!operation) return;
+    operation->Complete(ec, bytes);
+    operation.reset();
+  }
+
+  static void Close(State& state, size_t side) {
+    std::scoped_lock lock(state.mutex);
+    if (!state.open[side].exchange(false, std::memory_order_acq_rel)) return;
+    Pipe& out = state.pipes[side];
+    Pipe& in = state.pipes[1 - side];
+    out.writer_closed = true;
+    in.reader_closed = true;
+    in.begin = in.end = 0;
+    Finish(in.reader, asio::error::operation_aborted);
+    Finish(out.writer, asio::error::operation_aborted);
+    // Раз другая сторона ждёт чтения, буфер к ней пуст
+    Finish(out.reader, asio::error::eof);
+    Finish(in.writer, asio::error::broken_pipe);
+  }
+
+  error_code Connect(const LoopbackEndpoint& endpoint) {
+    if (is_open()) return asio::error::already_connected;
+
+    std::scoped_lock lock(RegistryMutex());
+    auto listener = Registry().find(endpoint.name);
+    if (listener == Registry().end()) return asio::error::connection_refused;
+
+    state_ = std::make_shared<State>(endpoint.name);
+    side_ = 0;
+    asio::use_service<Service>(asio::query(executor_, asio::execution::context))
+        .Add(state_, side_);
+
+    auto& accepts = listener->second->accepts;
+    if (accepts.empty()) {
+      listener->second->backlog.push_back(state_);
+    } else {
+      accepts.front()->Complete({}, state_);
+      accepts.pop_front();
+    }
+    return {};
+  }
+
+  template <typename Buffers, typename Handler>
+  void Read(const Buffers& buffers, Handler handler) {
+    if (!is_open()) {
+      Post(executor_, std::move(handler),
+           error_code(asio::error::bad_descriptor), size_t{0});
+      return;
+    }
+
+    std::scoped_lock lock(state_->mutex);
+    Pipe& in = state_->pipes[1 - side_];
+    if (asio::buffer_size(buffers) == 0) {
+      Post(executor_, std::move(handler), error_code(), size_t{0});
+    } else if (in.Size() > 0) {
+      size_t bytes = in.Take(buffers);
+      Post(executor_, std::move(handler), error_code(), bytes);
+      // Место освободилось, дописываем ждущую запись другой стороны
+      if (in.writer) Finish(in.writer, {}, in.writer->Transfer(in));
+    } else if (in.writer_closed) {
+      Post(executor_, std::move(handler), error_code(asio::error::eof),
+           size_t{0});
+    } else {
+      in.reader = MakeOperation<true>(buffers, std::move(handler));
+    }
+  }
+
+  template <typename Buffers, typename Handler>
+  void Write(const Buffers& buffers, Handler handler) {
+    if (!is_open()) {
+      Post(executor_, std::move(handler),
+           error_code(asio::error::bad_descriptor), size_t{0});
+      return;
+    }
+
+    std::scoped_lock lock(state_->mutex);
+    Pipe& out = state_->pipes[side_];
+    if (out.reader_closed) {
+      Post(executor_, std::move(handler), error_code(asio::error::broken_pipe),
+           size_t{0});
+    } else if (asio::buffer_size(buffers) == 0) {
+      Post(executor_, std::move(handler), error_code(), size_t{0});
+    } else if (out.Size() < out.data.size() || out.data.empty()) {
+      size_t bytes = out.Put(buffers);
+      Post(executor_, std::move(handler), error_code(), bytes);
+      if (out.reader) Finish(out.reader, {}, out.reader->Transfer(out));
+    } else {
+      out.writer = MakeOperation<false>(buffers, std::move(handler));
+    }
+  }
+
+  executor_type executor_;
+  std::shared_ptr<State> state_;
+  size_t side_ = 0;
+};
+
+// Слушает имя в пределах процесса. Принятые потоки привязываются к
+// io_context, переданному в async_accept, как у asio::ip::tcp::acceptor
+class LoopbackAcceptor {
+ public:
+  using executor_type = asio::any_io_executor;
+
+ public:
+  LoopbackAcceptor(asio::io_context& context, const LoopbackEndpoint& endpoint)
+      : executor_(context.get_executor()),
+        listener_(std::make_unique<LoopbackStream::Listener>()) {
+    listener_->name = endpoint.name;
+    std::scoped_lock lock(LoopbackStream::RegistryMutex());
+    if (!LoopbackStream::Registry()
+             .emplace(endpoint.name, listener_.get())
+             .second) {
+      throw system_error(asio::error::address_in_use, "loopback listen");
+    }
+  }
+
+  LoopbackAcceptor(const LoopbackAcceptor&) = delete;
+  LoopbackAcceptor& operator=(const LoopbackAcceptor&) = delete;
+
+  ~LoopbackAcceptor() { close(); }
+
+  executor_type get_executor() const noexcept { return executor_; }
+
+  LoopbackEndpoint local_endpoint() const { return {listener_->name}; }
+
+  // Ждущие async_accept завершаются operation_aborted, а не принятые ещё
+  // подключения закрываются
+  void close() {
+    std::scoped_lock lock(LoopbackStream::RegistryMutex());
+    if (listener_->closed) return;
+    listener_->closed = true;
+    LoopbackStream::Registry().erase(listener_->name);
+    for (auto& accept : listener_->accepts) {
+      accept->Complete(asio::error::operation_aborted, nullptr);
+    }
+    listener_->accepts.clear();
+    for (auto& state : listener_->backlog) {
+      LoopbackStream::Close(*state, 1);
+    }
+    listener_->backlog.clear();
+  }
+
+  template <typename Token>
+  auto async_accept(asio::io_context& context, Token&& token) {
+    return asio::async_initiate<Token, void(error_code, LoopbackStream)>(
+        [this, &context](auto handler) {
+          Accept(context, std::move(handler));
+        },
+        token);
+  }
+
+ private:
+  template <typename Handler>
+  class PendingAccept : public LoopbackStream::Accept {
+   public:
+    PendingAccept(asio::io_context& context, Handler handler,
+                  const executor_type& fallback)
+        : context_(context),
+          handler_(std::move(handler)),
+          work_(asio::prefer(asio::get_associated_executor(handler_, fallback),
+                             asio::execution::outstanding_work.tracked)) {}
+
+    void Complete(const error_code& ec,
+                  std::shared_ptr<LoopbackStream::State> state) override {
+      asio::post(work_, [handler = std::move(handler_), ec,
+                         stream = LoopbackStream(context_, std::move(state),
+                                                 1)]() mutable {
+        handler(ec, std::move(stream));
+      });
+    }
+
+   private:
+    asio::io_context& context_;
+    Handler handler_;
+    std::decay_t<decltype(asio::prefer(
+        std::declval<asio::associated_executor_t<Handler, executor_type>>(),
+        asio::execution::outstanding_work.tracked))>
+        work_;
+  };
+
+  template <typename Handler>
+  void Accept(asio::io_context& context, Handler handler) {
+    auto accept = std::make_unique<PendingAccept<Handler>>(
+        context, std::move(handler), executor_);
+
+    std::scoped_lock lock(LoopbackStream::RegistryMutex());
+    if (listener_->closed) {
+      accept->Complete(asio::error::bad_descriptor, nullptr);
+    } else if (listener_->backlog.empty()) {
+      listener_->accepts.push_back(std::move(accept));
+    } else {
+      accept->Complete({}, std::move(listener_->backlog.front()));
+      listener_->backlog.pop_front();
+    }
+  }
+
+  executor_type executor_;
+  std::unique_ptr<LoopbackStream::Listener> listener_;
+};
+}
@@ -0,0 +1,157 @@
+﻿#pragma once
+
+#include "BufferPool.h"
+#include "Common.h"
+#include "TSDeque.h"
+
+namespace net {
+// Lock-free очередь: писать могут сколько угодно потоков, читать только
+// один. Производители добавляют узел в односвязный список одним CAS, а
+// потребитель забирает сразу весь список одним exchange и разворачивает его
+// в порядке поступления
+template <typename T>
+class MPSCQueue {
+ public:
+  MPSCQueue() = default;
+  // нельзя копировать, поэтому
+  MPSCQueue(const MPSCQueue<T>&) = delete;
+  ~MPSCQueue() { Clear(); }
+
+ public:
+  void PushBack(const T& item) { Push(new (AllocateNode()) Node{item}); }
+
+  void PushBack(T&& item) {
+    Push(new (AllocateNode()) Node{std::move(item)});
+  }
+
+  // Дальше методы только для потока-потребителя
+
+  bool Empty() {
+    return cache_.empty() && head_.load(std::memory_order_acquire) == nullptr;
+  }
+
+  T PopFront() {
+    if (cache_.empty()) Collect();
+    auto t = std::move(cache_.front());
+    cache_.pop_front();
+    return t;
+  }
+
+  // Переносит в batch все ожидающие сообщения (но не больше max_count)
+  // за одну операцию над общим списком
+  size_t DrainInto(std::vector<T>& batch, size_t max_count = -1) {
+    Collect();
+    size_t count = std::min(max_count, cache_.size());
+    std::move(cache_.begin(), cache_.begin() + count,
+              std::back_inserter(batch));
+    cache_.erase(cache_.begin(), cache_.begin() + count);
+    return count;
+  }
+
+  void Clear() {
+    Collect();
+    cache_.clear();
+  }
+
+  // Ждём, пока очередь станет непустой. Потребитель сначала объявляет, что
+  // засыпает, и только потом проверяет очередь, а производитель сначала
+  // вставляет, а потом проверяет флаг: хотя бы один из них увидит другого,
+  // так что пробуждение не теряется
+  void Wait() {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    StartWaiting();
+    is_pushed_.wait(lock, [this]() { return !Empty(); });
+    waiting_.store(false, std::memory_order_relaxed);
+  }
+
+  // false, если к deadline очередь так и осталась пустой
+  template <typename Clock, typename Duration>
+  bool WaitUntil(const std::chrono::time_point<Clock, Duration>& deadline) {
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    StartWaiting();
+    bool ready =
+        is_pushed_.wait_until(lock, deadline, [this]() { return !Empty(); });
+    waiting_.store(false, std::memory_order_relaxed);
+    return ready;
+  }
+
+  template <typename Rep, typename Period>
+  bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) {
+    return WaitUntil(std::chrono::steady_clock::now() + timeout);
+  }
+
+ private:
+  struct Node {
+    T value;
+    Node* next = nullptr;
+  };
+
+  // Узлы тоже берутся из пула блоков
+  static void* AllocateNode() { return BufferPool::Allocate(sizeof(Node)); }
+
+  void Push(Node* node) {
+    Node* head = head_.load(std::memory_order_relaxed);
+    do {
+      node->next = head;
+    } while (!head_.compare_exchange_weak(head, node,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+    // Будим потребителя только при переходе из пустого состояния и только
+    // если он действительно спит: обычно мьютекс не трогается вовсе
+    if (head == nullptr) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiting_.load(std::memory_order_relaxed)) {
+        std::scoped_lock lock(wait_mutex_);
+        is_pushed_.notify_one();
+      }
+    }
+  }
+
+  void StartWaiting() {
+    waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Забирает весь общий список в локальный кэш потребителя
+  void Collect() {
+    Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+
+    // Список хранится от новых к старым, разворачиваем его
+    Node* reversed = nullptr;
+    while (node) {
+      Node* next = node->next;
+      node->next = reversed;
+      reversed = node;
+      node = next;
+    }
+    while (reversed) {
+      Node* next = reversed->next;
+      cache_.emplace_back(std::move(reversed->value));
+      reversed->~Node();
+      BufferPool::Release(reversed, sizeof(Node));
+      reversed = next;
+    }
+  }
+
+ protected:
+  std::atomic<Node*> head_ = nullptr;
+  // Уже забранные, но ещё не выданные потребителю элементы
+  std::deque<T> cache_;
+
+  std::atomic<bool> waiting_ = false;
+  std::mutex wait_mutex_;
+  std::condition_variable is_pushed_;
+};
+
+// Очередь входящих сообщений. По NetBench без конкуренции очередь на
+// мьютексах быстрее (push_pop 25 нс против 53), поэтому по умолчанию
+// остаётся она. Lock-free очередь включается NET_USE_MPSC_INCOMING, когда
+// её выигрыш при многих производителях будет подтверждён замерами
+#ifdef NET_USE_MPSC_INCOMING
+template <typename T>
+using IncomingQueue = MPSCQueue<T>;
+#else
+template <typename T>
+using IncomingQueue = TSDeque<T>;
+#endif
+}
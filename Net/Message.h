@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include "BufferPool.h"
 #include "Common.h"
 
 namespace net {
@@ -10,11 +11,16 @@ struct MessageHeader {
   uint32_t size = 0;
 };
 
+// Размер тела приходит от другой стороны, и под него выделяется память.
+// Соединение, приславшее заголовок с телом больше этого, разрывается
+constexpr uint32_t MAX_MESSAGE_SIZE = 1024 * 1024;
+
 
 template<typename T>
 struct Message {
   MessageHeader<T> header{};
-  std::vector<uint8_t> body;
+  // Память тела берётся из пула, чтобы поток сообщений не нагружал кучу
+  std::vector<uint8_t, PoolAllocator<uint8_t>> body;
 
   size_t Size() const {
     return body.size();
@@ -47,15 +53,35 @@ struct Message {
   }
 };
 
+// Неизменяемое сообщение с общим владением: тело сериализуется один раз и
+// разделяется очередями отправки всех получателей
 template<typename T>
-class Connection;
+using SharedMessage = std::shared_ptr<const Message<T>>;
 
 template<typename T>
+SharedMessage<T> MakeSharedMessage(Message<T> message) {
+  return std::allocate_shared<Message<T>>(PoolAllocator<Message<T>>(),
+                                          std::move(message));
+}
+
+namespace transport {
+struct Tcp;
+}
+
+template<typename T, typename Transport = transport::Tcp>
+class Connection;
+
+template<typename T, typename Transport = transport::Tcp>
 struct OwnedMessage {
-  std::shared_ptr<Connection<T>> remote = nullptr;
+  std::shared_ptr<Connection<T, Transport>> remote = nullptr;
   Message<T> message;
+  // Не сообщение, а уведомление о закрытии соединения. У сервера remote -
+  // отключившийся клиент
+  bool disconnected = false;
+  // Когда сообщение получено из сети, для метрики receive_to_handle
+  std::chrono::steady_clock::time_point received{};
 
-  friend std::ostream &operator<<(std::ostream &os, const OwnedMessage<T> &message) {
+  friend std::ostream &operator<<(std::ostream &os, const OwnedMessage &message) {
     os << message.message;
     return os;
   }
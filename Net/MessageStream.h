@@ -0,0 +1,125 @@
+﻿#pragma once
+
+#include <span>
+#include <string_view>
+
+#include "Common.h"
+#include "Message.h"
+
+namespace net {
+// Поля, которые можно переносить в тело сообщения простым memcpy
+template <typename DataType>
+concept Trivial = std::is_standard_layout_v<DataType> &&
+                  std::is_trivially_copyable_v<DataType>;
+
+// Пишет поля в тело сообщения по порядку, в отличие от operator<<.
+// Размер всех полей одного Write известен на этапе компиляции, поэтому
+// тело расширяется один раз, а структура копируется одним memcpy
+template <typename T>
+class MessageWriter {
+ public:
+  explicit MessageWriter(Message<T>& message, size_t reserve_bytes = 0)
+      : message_(message) {
+    message_.body.reserve(message_.body.size() + reserve_bytes);
+  }
+
+  template <Trivial... DataTypes>
+  MessageWriter& Write(const DataTypes&... data) {
+    constexpr size_t size = (sizeof(DataTypes) + ... + 0);
+    uint8_t* out = Grow(size);
+    ((std::memcpy(out, &data, sizeof(DataTypes)), out += sizeof(DataTypes)),
+     ...);
+    return *this;
+  }
+
+  // Длина (uint32_t) и сами байты
+  MessageWriter& WriteBytes(std::span<const uint8_t> bytes) {
+    uint32_t length = static_cast<uint32_t>(bytes.size());
+    uint8_t* out = Grow(sizeof(length) + bytes.size());
+    std::memcpy(out, &length, sizeof(length));
+    if (!bytes.empty()) {
+      std::memcpy(out + sizeof(length), bytes.data(), bytes.size());
+    }
+    return *this;
+  }
+
+  MessageWriter& WriteString(std::string_view text) {
+    return WriteBytes(std::span<const uint8_t>(
+        reinterpret_cast<const uint8_t*>(text.data()), text.size()));
+  }
+
+  template <Trivial DataType>
+  MessageWriter& operator<<(const DataType& data) {
+    return Write(data);
+  }
+
+ private:
+  uint8_t* Grow(size_t size) {
+    size_t shift = message_.body.size();
+    message_.body.resize(shift + size);
+    message_.header.size = static_cast<uint32_t>(message_.body.size());
+    return message_.body.data() + shift;
+  }
+
+  Message<T>& message_;
+};
+
+// Читает поля из тела сообщения по порядку записи. Чтение за концом тела
+// ничего не меняет и переводит читателя в состояние ошибки, которое
+// проверяется через operator bool. Строки и массивы байт возвращаются
+// представлениями прямо в тело, без копирования: они действительны, пока
+// живо сообщение
+template <typename T>
+class MessageReader {
+ public:
+  explicit MessageReader(const Message<T>& message) : message_(message) {}
+
+  template <Trivial... DataTypes>
+  bool Read(DataTypes&... data) {
+    constexpr size_t size = (sizeof(DataTypes) + ... + 0);
+    const uint8_t* in = Take(size);
+    if (in == nullptr) return false;
+    ((std::memcpy(&data, in, sizeof(DataTypes)), in += sizeof(DataTypes)),
+     ...);
+    return true;
+  }
+
+  std::span<const uint8_t> ReadBytes() {
+    uint32_t length = 0;
+    if (!Read(length)) return {};
+    const uint8_t* in = Take(length);
+    if (in == nullptr) return {};
+    return {in, length};
+  }
+
+  std::string_view ReadString() {
+    auto bytes = ReadBytes();
+    return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+  }
+
+  template <Trivial DataType>
+  MessageReader& operator>>(DataType& data) {
+    Read(data);
+    return *this;
+  }
+
+  size_t Remaining() const { return message_.body.size() - position_; }
+
+  explicit operator bool() const { return !failed_; }
+
+ private:
+  const uint8_t* Take(size_t size) {
+    if (failed_ || Remaining() < size) {
+      failed_ = true;
+      return nullptr;
+    }
+    const uint8_t* in = message_.body.data() + position_;
+    position_ += size;
+    return in;
+  }
+
+  const Message<T>& message_;
+  size_t position_ = 0;
+  bool failed_ = false;
+};
+}
@@ -0,0 +1,404 @@
+﻿#pragma once
+
+#include <bit>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#include "Common.h"
+
+namespace net {
+// Метрики процесса: счётчики и гистограммы. У каждого потока свой шард, и
+// пишет в него только этот поток, поэтому запись - это обычные load и
+// store без блокировок и атомарных RMW. GetSnapshot() складывает шарды всех
+// потоков, а шарды завершившихся потоков вливаются в общий остаток.
+// Кроме встроенных метрик сетевой библиотеки, приложение может
+// зарегистрировать свои через AddCounter и AddHistogram. С
+// NET_DISABLE_METRICS запись метрик ничего не делает
+class Metrics {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t MAX_COUNTERS = 32;
+  static constexpr size_t MAX_HISTOGRAMS = 8;
+  // Логарифмически-линейные корзины: 16 корзин на каждую степень двойки,
+  // погрешность около 6%
+  static constexpr int SUB_BITS = 4;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+  static constexpr int BUCKETS = 64 * SUB_BUCKETS;
+
+  enum class counter : uint32_t {
+    connections_accepted,
+    connections_closed,
+    // Получено из сети
+    messages_in,
+    bytes_in,
+    // Принято в очереди отправки, записано в сокет и выброшено при
+    // переполнении. Глубина очередей отправки: queued - out - dropped
+    messages_queued,
+    messages_out,
+    bytes_out,
+    messages_dropped,
+    // Прошло через очереди входящих сообщений сервера. Глубина:
+    // pushed - dispatched
+    incoming_pushed,
+    incoming_dispatched,
+    // Память операций ASIO соединений: всего и сколько пришлось взять из
+    // кучи, потому что в HandlerMemory не нашлось места
+    handler_allocations,
+    handler_heap_allocations,
+  };
+
+  // Значения в наносекундах
+  enum class histogram : uint32_t {
+    // От получения сообщения из сети до вызова OnMessage
+    receive_to_handle,
+    // От начала обработки входящего сообщения (или от Send вне
+    // обработчика) до окончания записи ответа в сокет
+    handle_to_write,
+  };
+
+  struct HistogramSnapshot {
+    std::string name;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    std::vector<uint64_t> buckets = std::vector<uint64_t>(BUCKETS);
+
+    double Mean() const {
+      return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+    }
+
+    // Нижняя граница корзины, в которую попал перцентиль percent
+    uint64_t Percentile(double percent) const {
+      if (count == 0) return 0;
+      uint64_t rank = static_cast<uint64_t>(percent / 100.0 * (count - 1));
+      uint64_t seen = 0;
+      for (int i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen > rank) return ValueOf(i);
+      }
+      return ValueOf(BUCKETS - 1);
+    }
+  };
+
+  struct Snapshot {
+    Clock::time_point time;
+    std::vector<std::string> counter_names;
+    std::vector<uint64_t> counters;
+    std::vector<HistogramSnapshot> histograms;
+
+    uint64_t Get(counter id) const { return counters[Index(id)]; }
+    const HistogramSnapshot& Get(histogram id) const {
+      return histograms[Index(id)];
+    }
+
+    // Прирост с более раннего снимка: из пары снимков получаются скорости
+    // и перцентили за интервал
+    Snapshot operator-(const Snapshot& earlier) const {
+      Snapshot delta = *this;
+      for (size_t i = 0; i < earlier.counters.size(); ++i) {
+        delta.counters[i] -= earlier.counters[i];
+      }
+      for (size_t h = 0; h < earlier.histograms.size(); ++h) {
+        auto& histogram = delta.histograms[h];
+        histogram.count -= earlier.histograms[h].count;
+        histogram.sum -= earlier.histograms[h].sum;
+        for (int i = 0; i < BUCKETS; ++i) {
+          histogram.buckets[i] -= earlier.histograms[h].buckets[i];
+        }
+      }
+      return delta;
+    }
+  };
+
+ public:
+  static void Add(counter id, uint64_t value = 1) {
+#ifndef NET_DISABLE_METRICS
+    if (Shard* shard = Local()) Bump(shard->counters[Index(id)], value);
+#endif
+  }
+
+  static void Record(histogram id, uint64_t value) {
+#ifndef NET_DISABLE_METRICS
+    if (Shard* shard = Local()) {
+      Bump(shard->histograms[Index(id)].buckets[IndexOf(value)], 1);
+      Bump(shard->histograms[Index(id)].sum, value);
+    }
+#endif
+  }
+
+  static void Record(histogram id, Clock::duration elapsed) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    Record(id, static_cast<uint64_t>(std::max<int64_t>(0, ns.count())));
+  }
+
+  // Метрики приложения. Повторная регистрация того же имени возвращает
+  // прежний номер
+  static counter AddCounter(const std::string& name) {
+    return static_cast<counter>(Register(GetState().counter_names, name,
+                                         MAX_COUNTERS));
+  }
+
+  static histogram AddHistogram(const std::string& name) {
+    return static_cast<histogram>(Register(GetState().histogram_names, name,
+                                           MAX_HISTOGRAMS));
+  }
+
+  static Snapshot GetSnapshot() {
+    State& state = GetState();
+    Snapshot snapshot;
+    std::scoped_lock lock(state.mutex);
+    snapshot.time = Clock::now();
+    snapshot.counter_names = state.counter_names;
+    snapshot.counters.resize(state.counter_names.size());
+    snapshot.histograms.resize(state.histogram_names.size());
+    for (size_t h = 0; h < snapshot.histograms.size(); ++h) {
+      snapshot.histograms[h].name = state.histogram_names[h];
+    }
+
+    auto merge = [&](const Shard& shard) {
+      for (size_t i = 0; i < snapshot.counters.size(); ++i) {
+        snapshot.counters[i] += shard.counters[i].load(
+            std::memory_order_relaxed);
+      }
+      for (size_t h = 0; h < snapshot.histograms.size(); ++h) {
+        auto& histogram = snapshot.histograms[h];
+        histogram.sum += shard.histograms[h].sum.load(
+            std::memory_order_relaxed);
+        for (int i = 0; i < BUCKETS; ++i) {
+          uint64_t count = shard.histograms[h].buckets[i].load(
+              std::memory_order_relaxed);
+          histogram.buckets[i] += count;
+          histogram.count += count;
+        }
+      }
+    };
+    for (auto& shard : state.shards) merge(*shard);
+    merge(state.retired);
+    return snapshot;
+  }
+
+  // Одна строка: скорости ненулевых счётчиков за интервал и перцентили
+  // гистограмм в микросекундах
+  static std::string Format(const Snapshot& delta, double seconds) {
+    std::string line;
+    char buffer[160];
+    for (size_t i = 0; i < delta.counters.size(); ++i) {
+      if (delta.counters[i] == 0) continue;
+      std::snprintf(buffer, sizeof(buffer), " %s %.0f/s",
+                    delta.counter_names[i].c_str(),
+                    delta.counters[i] / std::max(seconds, 1e-9));
+      line += buffer;
+    }
+    for (auto& histogram : delta.histograms) {
+      if (histogram.count == 0) continue;
+      std::snprintf(buffer, sizeof(buffer),
+                    " %s p50 %.1fus p99 %.1fus p999 %.1fus",
+                    histogram.name.c_str(),
+                    histogram.Percentile(50) / 1e3,
+                    histogram.Percentile(99) / 1e3,
+                    histogram.Percentile(99.9) / 1e3);
+      line += buffer;
+    }
+    return line;
+  }
+
+  // Начало обработки входящего сообщения в этом потоке. От него
+  // отсчитывается handle_to_write всего, что обработчик отправит
+  class HandlingScope {
+   public:
+    explicit HandlingScope(Clock::time_point start) {
+      HandlingStart() = start;
+    }
+    ~HandlingScope() { HandlingStart() = {}; }
+  };
+
+  // Отметка времени для сообщения, которое ставится в очередь отправки
+  static Clock::time_point SendTime() {
+    Clock::time_point start = HandlingStart();
+    return start == Clock::time_point{} ? Clock::now() : start;
+  }
+
+ private:
+  struct ShardHistogram {
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> sum = 0;
+  };
+
+  struct Shard {
+    std::atomic<uint64_t> counters[MAX_COUNTERS] = {};
+    ShardHistogram histograms[MAX_HISTOGRAMS];
+  };
+
+  struct State {
+    State() {
+      counter_names = {"connections_accepted", "connections_closed",
+                       "messages_in",          "bytes_in",
+                       "messages_queued",      "messages_out",
+                       "bytes_out",            "messages_dropped",
+                       "incoming_pushed",      "incoming_dispatched",
+                       "handler_allocations",  "handler_heap_allocations"};
+      histogram_names = {"receive_to_handle", "handle_to_write"};
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> counter_names;
+    std::vector<std::string> histogram_names;
+    std::vector<std::unique_ptr<Shard>> shards;
+    // Сумма шардов завершившихся потоков
+    Shard retired;
+  };
+
+  // Без деструктора, поэтому доступна потоку до самого конца
+  struct LocalShard {
+    Shard* shard = nullptr;
+    bool retired = false;
+  };
+
+  // Поток отдаёт свой шард при завершении
+  struct ShardOwner {
+    ~ShardOwner() {
+      LocalShard& local = GetLocal();
+      Retire(local.shard);
+      local.shard = nullptr;
+      local.retired = true;
+    }
+  };
+
+  static State& GetState() {
+    static State state;
+    return state;
+  }
+
+  template <typename Id>
+  static size_t Index(Id id) {
+    return static_cast<size_t>(id);
+  }
+
+  // Пишет только поток-владелец шарда, поэтому хватает load и store
+  static void Bump(std::atomic<uint64_t>& value, uint64_t delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta,
+                std::memory_order_relaxed);
+  }
+
+  static Clock::time_point& HandlingStart() {
+    thread_local Clock::time_point start{};
+    return start;
+  }
+
+  // nullptr, когда thread_local шарды потока уже разрушены: так бывает в
+  // деструкторах статических объектов
+  static LocalShard& GetLocal() {
+    thread_local LocalShard local;
+    return local;
+  }
+
+  static Shard* Local() {
+    LocalShard& local = GetLocal();
+    if (local.shard == nullptr && !local.retired) {
+      thread_local ShardOwner owner;
+      State& state = GetState();
+      std::scoped_lock lock(state.mutex);
+      state.shards.push_back(std::make_unique<Shard>());
+      local.shard = state.shards.back().get();
+    }
+    return local.shard;
+  }
+
+  static void Retire(Shard* shard) {
+    if (shard == nullptr) return;
+    State& state = GetState();
+    std::scoped_lock lock(state.mutex);
+    for (size_t i = 0; i < MAX_COUNTERS; ++i) {
+      Bump(state.retired.counters[i],
+           shard->counters[i].load(std::memory_order_relaxed));
+    }
+    for (size_t h = 0; h < MAX_HISTOGRAMS; ++h) {
+      Bump(state.retired.histograms[h].sum,
+           shard->histograms[h].sum.load(std::memory_order_relaxed));
+      for (int i = 0; i < BUCKETS; ++i) {
+        Bump(state.retired.histograms[h].buckets[i],
+             shard->histograms[h].buckets[i].load(std::memory_order_relaxed));
+      }
+    }
+    std::erase_if(state.shards,
+                  [&](const auto& owned) { return owned.get() == shard; });
+  }
+
+  static size_t Register(std::vector<std::string>& names,
+                         const std::string& name, size_t limit) {
+    State& state = GetState();
+    std::scoped_lock lock(state.mutex);
+    auto it = std::find(names.begin(), names.end(), name);
+    if (it != names.end()) return it - names.begin();
+    if (names.size() == limit) {
+      throw std::length_error("too many metrics, cannot add " + name);
+    }
+    names.push_back(name);
+    return names.size() - 1;
+  }
+
+  static int IndexOf(uint64_t value) {
+    if (value < SUB_BUCKETS) return static_cast<int>(value);
+    int msb = std::bit_width(value) - 1;
+    int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS +
+           static_cast<int>((value >> shift) - SUB_BUCKETS);
+  }
+
+  static uint64_t ValueOf(int index) {
+    if (index < SUB_BUCKETS) return index;
+    int group = index / SUB_BUCKETS;
+    uint64_t sub = index % SUB_BUCKETS;
+    return (SUB_BUCKETS + sub) << (group - 1);
+  }
+};
+
+// Поток, который раз в interval снимает метрики и отдаёт sink полный
+// снимок и прирост за интервал
+class MetricsDump {
+ public:
+  using Sink = std::function<void(const Metrics::Snapshot& total,
+                                  const Metrics::Snapshot& delta,
+                                  double seconds)>;
+
+ public:
+  MetricsDump() = default;
+  MetricsDump(const MetricsDump&) = delete;
+  ~MetricsDump() { Stop(); }
+
+  void Start(std::chrono::milliseconds interval, Sink sink) {
+    Stop();
+    stop_ = false;
+    thread_ = std::thread([this, interval, sink = std::move(sink)]() {
+      Metrics::Snapshot previous = Metrics::GetSnapshot();
+      std::unique_lock lock(mutex_);
+      while (!stopped_.wait_for(lock, interval, [this]() { return stop_; })) {
+        lock.unlock();
+        Metrics::Snapshot current = Metrics::GetSnapshot();
+        double seconds =
+            std::chrono::duration<double>(current.time - previous.time)
+                .count();
+        sink(current, current - previous, seconds);
+        previous = std::move(current);
+        lock.lock();
+      }
+    });
+  }
+
+  void Stop() {
+    {
+      std::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    stopped_.notify_one();
+    if (thread_.joinable()) thread_.join();
+  }
+
+ private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stopped_;
+  bool stop_ = false;
+};
+}
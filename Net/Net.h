@@ -1,8 +1,18 @@
-#pragma once
+﻿#pragma once
 
 #include "Common.h"
+#include "BufferPool.h"
+#include "HandlerAllocator.h"
 #include "TSDeque.h"
+#include "MPSCQueue.h"
+#include "Log.h"
+#include "Loopback.h"
 #include "Message.h"
+#include "MessageStream.h"
+#include "Metrics.h"
+#include "SlotMap.h"
+#include "Transport.h"
 #include "IClient.h"
 #include "IServer.h"
-#include "Connection.h"
\ No newline at end of file
+#include "Connection.h"
+#include "ContextPool.h"
\ No newline at end of file
@@ -0,0 +1,160 @@
+﻿#pragma once
+
+#include <optional>
+
+#include "Common.h"
+
+namespace net {
+// Таблица с поколениями. Handle хранит номер ячейки (младшие INDEX_BITS
+// бит) и её поколение, которое растёт при каждом удалении, так что старый
+// handle после переиспользования ячейки просто перестаёт находиться.
+// Поиск, вставка и удаление за O(1), освобождённые ячейки переиспользуются,
+// и память не растёт при бесконечных подключениях и отключениях.
+// Свободные ячейки выдаются по очереди (FIFO): одна и та же ячейка
+// переиспользуется как можно реже, и поколения медленнее идут по кругу
+template <typename V>
+class SlotMap {
+ public:
+  using Handle = uint32_t;
+
+  static constexpr uint32_t INDEX_BITS = 20;
+  static constexpr uint32_t MAX_SLOTS = 1u << INDEX_BITS;
+  // Поколения начинаются с 1, поэтому handle 0 никогда не бывает валидным
+  static constexpr Handle NULL_HANDLE = 0;
+
+ public:
+  SlotMap() = default;
+  SlotMap(const SlotMap&) = delete;
+
+  // NULL_HANDLE, если свободных ячеек больше нет
+  Handle Insert(V value) {
+    uint32_t index = 0;
+    if (free_head_ != NONE) {
+      index = free_head_;
+      free_head_ = slots_[index].next_free;
+      if (free_head_ == NONE) free_tail_ = NONE;
+    } else if (slots_.size() < MAX_SLOTS) {
+      index = static_cast<uint32_t>(slots_.size());
+      slots_.emplace_back();
+    } else {
+      return NULL_HANDLE;
+    }
+
+    Slot& slot = slots_[index];
+    slot.value.emplace(std::move(value));
+    ++size_;
+    return MakeHandle(index, slot.generation);
+  }
+
+  // Возвращает значение под прежним handle, например после перезапуска
+  // процесса. Ячейки восстанавливаются по возрастанию номера до первой
+  // обычной вставки, пропущенные становятся свободными
+  bool Restore(Handle handle, V value) {
+    uint32_t index = IndexOf(handle);
+    uint32_t generation = GenerationOf(handle);
+    if (index < slots_.size() || generation == 0) return false;
+
+    // Release считает ячейку только что освобождённой, отсюда ++size_
+    while (slots_.size() < index) {
+      slots_.emplace_back();
+      ++size_;
+      Release(static_cast<uint32_t>(slots_.size() - 1));
+    }
+    Slot& slot = slots_.emplace_back();
+    slot.value.emplace(std::move(value));
+    slot.generation = generation;
+    ++size_;
+    return true;
+  }
+
+  V* Find(Handle handle) {
+    Slot* slot = SlotOf(handle);
+    return slot ? &*slot->value : nullptr;
+  }
+
+  bool Contains(Handle handle) const {
+    uint32_t index = IndexOf(handle);
+    return index < slots_.size() && slots_[index].value &&
+           slots_[index].generation == GenerationOf(handle);
+  }
+
+  // Забирает значение из таблицы, чтобы его можно было уничтожить уже без
+  // блокировки, под которой обычно живёт таблица
+  std::optional<V> Extract(Handle handle) {
+    Slot* slot = SlotOf(handle);
+    if (!slot) return std::nullopt;
+
+    std::optional<V> value = std::move(slot->value);
+    slot->value.reset();
+    Release(IndexOf(handle));
+    return value;
+  }
+
+  bool Erase(Handle handle) { return Extract(handle).has_value(); }
+
+  void Clear() {
+    for (uint32_t index = 0; index < slots_.size(); ++index) {
+      if (slots_[index].value) {
+        slots_[index].value.reset();
+        Release(index);
+      }
+    }
+  }
+
+  // Обходит все занятые ячейки
+  template <typename Function>
+  void ForEach(Function function) {
+    for (Slot& slot : slots_) {
+      if (slot.value) function(*slot.value);
+    }
+  }
+
+  size_t Size() const { return size_; }
+  size_t Capacity() const { return slots_.size(); }
+
+  static uint32_t IndexOf(Handle handle) { return handle & (MAX_SLOTS - 1); }
+  static uint32_t GenerationOf(Handle handle) { return handle >> INDEX_BITS; }
+
+ private:
+  static constexpr uint32_t NONE = ~0u;
+  static constexpr uint32_t MAX_GENERATION = ~0u >> INDEX_BITS;
+
+  struct Slot {
+    std::optional<V> value;
+    uint32_t generation = 1;
+    uint32_t next_free = NONE;
+  };
+
+  static Handle MakeHandle(uint32_t index, uint32_t generation) {
+    return (generation << INDEX_BITS) | index;
+  }
+
+  Slot* SlotOf(Handle handle) {
+    uint32_t index = IndexOf(handle);
+    if (index >= slots_.size()) return nullptr;
+    Slot& slot = slots_[index];
+    if (!slot.value || slot.generation != GenerationOf(handle)) return nullptr;
+    return &slot;
+  }
+
+  // Ячейка уже пуста: сдвигаем поколение и ставим её в конец очереди
+  void Release(uint32_t index) {
+    Slot& slot = slots_[index];
+    slot.generation = slot.generation == MAX_GENERATION ? 1
+                                                        : slot.generation + 1;
+    slot.next_free = NONE;
+    if (free_tail_ != NONE) {
+      slots_[free_tail_].next_free = index;
+    } else {
+      free_head_ = index;
+    }
+    free_tail_ = index;
+    --size_;
+  }
+
+  std::vector<Slot> slots_;
+  uint32_t free_head_ = NONE;
+  uint32_t free_tail_ = NONE;
+  size_t size_ = 0;
+};
+}
@@ -37,17 +37,34 @@ class TSDeque {
   }
 
   void PushBack(const T& item) {
-    std::scoped_lock lock(deque_mutex_);
-    deque_.emplace_back(std::move(item));
+    {
+      std::scoped_lock lock(deque_mutex_);
+      deque_.emplace_back(item);
+    }
+    is_pushed_.notify_one();
+  }
 
-    std::unique_lock<std::mutex> ulock(wait_push_mutex_);
+  void PushBack(T&& item) {
+    {
+      std::scoped_lock lock(deque_mutex_);
+      deque_.emplace_back(std::move(item));
+    }
     is_pushed_.notify_one();
   }
 
   void PushFront(const T& item) {
-    std::scoped_lock lock(deque_mutex_);
-    deque_.emplace_front(std::move(item));
-    std::unique_lock<std::mutex> ulock(wait_push_mutex_);
+    {
+      std::scoped_lock lock(deque_mutex_);
+      deque_.emplace_front(item);
+    }
+    is_pushed_.notify_one();
+  }
+
+  void PushFront(T&& item) {
+    {
+      std::scoped_lock lock(deque_mutex_);
+      deque_.emplace_front(std::move(item));
+    }
     is_pushed_.notify_one();
   }
 
@@ -62,22 +79,45 @@ class TSDeque {
     return deque_.size();
   }
 
+  // Переносит в batch все элементы (но не больше max_count) за один захват
+  // мьютекса
+  size_t DrainInto(std::vector<T>& batch, size_t max_count = -1) {
+    std::scoped_lock lock(deque_mutex_);
+    size_t count = std::min(max_count, deque_.size());
+    std::move(deque_.begin(), deque_.begin() + count,
+              std::back_inserter(batch));
+    deque_.erase(deque_.begin(), deque_.begin() + count);
+    return count;
+  }
+
   void Clear() {
     std::scoped_lock lock(deque_mutex_);
     deque_.clear();
   }
 
+  // Проверка и засыпание идут под тем же мьютексом, что и вставка, поэтому
+  // пробуждение не может потеряться между ними
   void Wait() {
-    while (Empty()) {
-      std::unique_lock<std::mutex> ulock(wait_push_mutex_);
-      is_pushed_.wait(ulock);
-    }
+    std::unique_lock<std::mutex> lock(deque_mutex_);
+    is_pushed_.wait(lock, [this]() { return !deque_.empty(); });
+  }
+
+  // false, если к deadline очередь так и осталась пустой
+  template <typename Clock, typename Duration>
+  bool WaitUntil(const std::chrono::time_point<Clock, Duration>& deadline) {
+    std::unique_lock<std::mutex> lock(deque_mutex_);
+    return is_pushed_.wait_until(lock, deadline,
+                                 [this]() { return !deque_.empty(); });
+  }
+
+  template <typename Rep, typename Period>
+  bool WaitFor(const std::chrono::duration<Rep, Period>& timeout) {
+    return WaitUntil(std::chrono::steady_clock::now() + timeout);
   }
 
  protected:
   std::mutex deque_mutex_;
   std::deque<T> deque_;
   std::condition_variable is_pushed_;
-  std::mutex wait_push_mutex_;
 };
 } 
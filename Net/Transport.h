@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <filesystem>
+#include <string>
+
+#include "Common.h"
+#include "Loopback.h"
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS) || defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#define NET_HAS_LOCAL_SOCKETS
+#endif
+
+namespace net {
+// Транспорты соединений. Connection, IServer и IClient параметризуются
+// одним из них и берут отсюда типы сокета, приёмника и адреса, а всё, что
+// выше сокета (кадры сообщений, очереди, strand'ы), от транспорта не зависит
+namespace transport {
+// TCP, транспорт по умолчанию
+struct Tcp {
+  using Socket = asio::ip::tcp::socket;
+  using Acceptor = asio::ip::tcp::acceptor;
+  using Endpoint = asio::ip::tcp::endpoint;
+
+  static Acceptor Listen(asio::io_context& context, const Endpoint& endpoint) {
+    return Acceptor(context, endpoint);
+  }
+
+  // Кто подключился, для лога
+  static Endpoint Peer(const Socket& socket) {
+    return socket.remote_endpoint();
+  }
+};
+
+#ifdef NET_HAS_LOCAL_SOCKETS
+// Unix domain socket: клиент на той же машине (например, шлюз) ходит к
+// серверу в обход TCP-стека
+struct Local {
+  using Socket = asio::local::stream_protocol::socket;
+  using Acceptor = asio::local::stream_protocol::acceptor;
+  using Endpoint = asio::local::stream_protocol::endpoint;
+
+  // Файл сокета, оставшийся от прошлого запуска, мешает bind
+  static Acceptor Listen(asio::io_context& context, const Endpoint& endpoint) {
+    std::error_code ec;
+    std::filesystem::remove(endpoint.path(), ec);
+    return Acceptor(context, endpoint);
+  }
+
+  // У клиентских unix-сокетов обычно нет имени, пишем путь сервера
+  static std::string Peer(const Socket& socket) {
+    return "unix:" + socket.local_endpoint().path();
+  }
+};
+#endif
+
+// Поток в памяти процесса, см. LoopbackStream: для бенчмарков без шума
+// ядра и для сервера, встроенного в тот же процесс
+struct Loopback {
+  using Socket = LoopbackStream;
+  using Acceptor = LoopbackAcceptor;
+  using Endpoint = LoopbackEndpoint;
+
+  static Acceptor Listen(asio::io_context& context, const Endpoint& endpoint) {
+    return Acceptor(context, endpoint);
+  }
+
+  static std::string Peer(const Socket& socket) {
+    return "loopback:" + socket.remote_endpoint().name;
+  }
+};
+}
+}